@@ -1,12 +1,30 @@
 // Autorzy: Marcin Mordecki, Michał Skwarek.
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <cstring>
-#include <string>
 #include <vector>
 #include <unordered_map>
 #include <iostream>
 #include <unordered_set>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "maptel.h"
 
 #ifdef NDEBUG
@@ -19,16 +37,562 @@ namespace jnp1 {
     namespace {
         using std::unordered_map;
         using std::unordered_set;
-        using std::string;
+        using std::vector;
         using ulong = unsigned long;
-        using dict = unordered_map<string, string>;
 
-        // Tworzy mapę słowników.
-        unordered_map<ulong, dict> &dictionaries() {
-            static unordered_map<ulong, dict> dictionaries;
+        // Liczba cyfr numeru zapisywanych w słowie low klucza.
+        constexpr size_t LOW_DIGITS = 16;
+        // Pozycja długości numeru w słowie high klucza.
+        constexpr unsigned LENGTH_SHIFT = 56;
+
+        static_assert(TEL_NUM_MAX_LEN - LOW_DIGITS <= LENGTH_SHIFT / 4,
+                      "cyfry numeru muszą zmieścić się w kluczu");
+
+        // Numer telefonu zapisany w kodzie BCD, po cztery bity na cyfrę.
+        // Cyfry od pierwszej są w kolejnych półbajtach słowa low, a po jego
+        // wypełnieniu w słowie high, którego najstarszy bajt to długość.
+        struct tel_key {
+            uint64_t low;
+            uint64_t high;
+
+            bool operator==(tel_key const &other) const {
+                return low == other.low && high == other.high;
+            }
+
+            bool operator!=(tel_key const &other) const {
+                return !(*this == other);
+            }
+
+            size_t length() const {
+                return high >> LENGTH_SHIFT;
+            }
+
+            unsigned nibble(size_t i) const {
+                uint64_t word = i < LOW_DIGITS ? low : high;
+                return static_cast<unsigned>((word >> (i % LOW_DIGITS * 4)) &
+                                             15);
+            }
+
+            char digit(size_t i) const {
+                return static_cast<char>('0' + nibble(i));
+            }
+
+            // Dopisuje cyfrę o wartości d na końcu numeru.
+            void push_back(unsigned d) {
+                size_t i = length();
+                (i < LOW_DIGITS ? low : high) |= static_cast<uint64_t>(d)
+                                                 << (i % LOW_DIGITS * 4);
+                high += uint64_t(1) << LENGTH_SHIFT;
+            }
+        };
+
+        // Zwraca n cyfr numeru key, zaczynając od cyfry pos.
+        tel_key tel_substr(tel_key key, size_t pos, size_t n) {
+            tel_key result{0, 0};
+            for (size_t i = pos; i < pos + n; ++i)
+                result.push_back(key.nibble(i));
+            return result;
+        }
+
+        // Zwraca prefix z dopisanymi cyframi numeru key od cyfry pos.
+        tel_key tel_concat(tel_key prefix, tel_key key, size_t pos) {
+            for (size_t i = pos; i < key.length(); ++i)
+                prefix.push_back(key.nibble(i));
+            return prefix;
+        }
+
+        // Miesza bity obu słów klucza. Wynik nie zależy od platformy, bo
+        // wyznacza położenie numerów w tablicy zapisanej w pliku migawki.
+        uint64_t hash_of_tel(tel_key const &key) {
+            uint64_t h = key.low * 0x9e3779b97f4a7c15ULL;
+            h ^= key.high + 0x632be59bd9b4e019ULL + (h << 6) + (h >> 2);
+            h ^= h >> 29;
+            h *= 0xbf58476d1ce4e5b9ULL;
+            return h ^ (h >> 32);
+        }
+
+        // Funkcja haszująca klucze.
+        struct tel_hash {
+            size_t operator()(tel_key const &key) const {
+                return static_cast<size_t>(hash_of_tel(key));
+            }
+        };
+
+        template<typename T>
+        using tel_map = unordered_map<tel_key, T, tel_hash>;
+        using tel_set = unordered_set<tel_key, tel_hash>;
+
+        // Zwraca słowo z półbajtami w odwrotnej kolejności.
+        uint64_t reversed_nibbles(uint64_t word) {
+            word = (word << 32) | (word >> 32);
+            word = ((word & 0x0000ffff0000ffffULL) << 16) |
+                   ((word >> 16) & 0x0000ffff0000ffffULL);
+            word = ((word & 0x00ff00ff00ff00ffULL) << 8) |
+                   ((word >> 8) & 0x00ff00ff00ff00ffULL);
+            return ((word & 0x0f0f0f0f0f0f0f0fULL) << 4) |
+                   ((word >> 4) & 0x0f0f0f0f0f0f0f0fULL);
+        }
+
+        // Porządek leksykograficzny cyfr numerów. Numery zaczynające się od
+        // danego prefiksu leżą w nim obok siebie, od samego prefiksu do
+        // prefiksu dopełnionego dziewiątkami do TEL_NUM_MAX_LEN cyfr.
+        struct digit_order {
+            bool operator()(tel_key const &a, tel_key const &b) const {
+                if (a.low != b.low)
+                    return reversed_nibbles(a.low) < reversed_nibbles(b.low);
+
+                uint64_t digits = (uint64_t(1) << LENGTH_SHIFT) - 1;
+                uint64_t a_high = reversed_nibbles(a.high & digits);
+                uint64_t b_high = reversed_nibbles(b.high & digits);
+                if (a_high != b_high)
+                    return a_high < b_high;
+                return a.length() < b.length();
+            }
+        };
+
+        using tel_ordered_set = std::set<tel_key, digit_order>;
+
+        // Skompresowane drzewo trie nad cyframi z regułami zmiany prefiksów
+        // numerów. Krawędź do każdego węzła poza korzeniem ma etykietę z co
+        // najmniej jedną cyfrą, a węzeł bez reguły ma co najmniej dwoje
+        // dzieci, więc głębokość drzewa nie zależy od liczby reguł.
+        class prefix_trie {
+        public:
+            bool empty() const {
+                return rules == 0;
+            }
+
+            // Wstawia regułę zmiany prefiksu src na dst, nadpisując
+            // istniejącą regułę dla src.
+            void insert(tel_key src, tel_key dst) {
+                node *n = &root;
+                size_t pos = 0;
+
+                while (pos < src.length()) {
+                    std::unique_ptr<node> &child = n->children[src.nibble(pos)];
+
+                    if (!child) {
+                        child = std::make_unique<node>();
+                        child->label = tel_substr(src, pos,
+                                                  src.length() - pos);
+                        n = child.get();
+                        break;
+                    }
+
+                    size_t common = common_length(child->label, src, pos);
+                    size_t label_length = child->label.length();
+
+                    if (common < label_length) {
+                        // Dzieli krawędź, wstawiając węzeł po wspólnej części.
+                        auto split = std::make_unique<node>();
+                        split->label = tel_substr(child->label, 0, common);
+                        child->label = tel_substr(child->label, common,
+                                                  label_length - common);
+                        unsigned first = child->label.nibble(0);
+                        split->children[first] = std::move(child);
+                        child = std::move(split);
+                    }
+
+                    n = child.get();
+                    pos += common;
+                }
+
+                rules += !n->has_rule;
+                n->has_rule = true;
+                n->dst = dst;
+            }
+
+            // Usuwa regułę prefiksu src. Zwraca false, jeśli jej nie było.
+            bool erase(tel_key src) {
+                // Miejsca węzłów na ścieżce od korzenia do węzła src.
+                std::array<std::unique_ptr<node> *, TEL_NUM_MAX_LEN> path;
+                size_t depth = 0;
+                node *n = &root;
+                size_t pos = 0;
+
+                while (pos < src.length()) {
+                    std::unique_ptr<node> &child = n->children[src.nibble(pos)];
+                    if (!child || pos + child->label.length() > src.length() ||
+                        common_length(child->label, src, pos) <
+                        child->label.length())
+                        return false;
+
+                    path[depth++] = &child;
+                    n = child.get();
+                    pos += n->label.length();
+                }
+
+                if (depth == 0 || !n->has_rule)
+                    return false;
+
+                n->has_rule = false;
+                --rules;
+
+                // Usunięcie reguły może zostawić zbędny węzeł, a usunięcie
+                // węzła zbędnego rodzica.
+                prune(*path[depth - 1]);
+                if (depth >= 2)
+                    prune(*path[depth - 2]);
+                return true;
+            }
+
+            // Zapisuje w result numer tel po zastosowaniu reguły najdłuższego
+            // pasującego prefiksu, po której numer ma co najwyżej
+            // TEL_NUM_MAX_LEN cyfr. Zwraca false, jeśli takiej reguły nie ma.
+            bool apply(tel_key tel, tel_key &result) const {
+                node const *n = &root;
+                node const *best = nullptr;
+                size_t best_pos = 0;
+                size_t pos = 0;
+
+                while (true) {
+                    if (n->has_rule &&
+                        tel.length() - pos + n->dst.length() <= TEL_NUM_MAX_LEN) {
+                        best = n;
+                        best_pos = pos;
+                    }
+                    if (pos == tel.length())
+                        break;
+
+                    node const *child = n->children[tel.nibble(pos)].get();
+                    if (child == nullptr ||
+                        pos + child->label.length() > tel.length() ||
+                        common_length(child->label, tel, pos) <
+                        child->label.length())
+                        break;
+
+                    n = child;
+                    pos += child->label.length();
+                }
+
+                if (best == nullptr)
+                    return false;
+
+                result = tel_concat(best->dst, tel, best_pos);
+                return true;
+            }
+
+            // Wywołuje f(src, dst) dla każdej reguły.
+            template<typename F>
+            void for_each(F f) const {
+                visit(root, tel_key{0, 0}, f);
+            }
+
+        private:
+            struct node {
+                // Cyfry na krawędzi prowadzącej do węzła.
+                tel_key label{0, 0};
+                bool has_rule = false;
+                tel_key dst{0, 0};
+                std::array<std::unique_ptr<node>, 10> children;
+            };
+
+            // Zwraca długość wspólnego początku etykiety label i cyfr numeru
+            // key od cyfry pos.
+            static size_t common_length(tel_key label, tel_key key,
+                                        size_t pos) {
+                size_t common = 0;
+                while (common < label.length() && pos + common < key.length() &&
+                       label.nibble(common) == key.nibble(pos + common))
+                    ++common;
+                return common;
+            }
+
+            // Usuwa węzeł bez reguły i dzieci, a węzeł bez reguły z jednym
+            // dzieckiem łączy z tym dzieckiem.
+            static void prune(std::unique_ptr<node> &slot) {
+                if (!slot || slot->has_rule)
+                    return;
+
+                std::unique_ptr<node> *only = nullptr;
+                for (std::unique_ptr<node> &child : slot->children) {
+                    if (!child)
+                        continue;
+                    if (only != nullptr)
+                        return;
+                    only = &child;
+                }
+
+                if (only == nullptr) {
+                    slot.reset();
+                    return;
+                }
+
+                std::unique_ptr<node> child = std::move(*only);
+                child->label = tel_concat(slot->label, child->label, 0);
+                slot = std::move(child);
+            }
+
+            template<typename F>
+            static void visit(node const &n, tel_key prefix, F &f) {
+                if (n.has_rule)
+                    f(prefix, n.dst);
+
+                for (auto const &child : n.children)
+                    if (child)
+                        visit(*child, tel_concat(prefix, child->label, 0), f);
+            }
+
+            node root;
+            size_t rules = 0;
+        };
+
+        // Wyróżnik pliku migawki słownika.
+        constexpr char SNAPSHOT_MAGIC[8] = {'M', 'A', 'P', 'T',
+                                            'E', 'L', 'S', 'N'};
+        // Wersja formatu pliku migawki. Wersja 1 nie ma części z regułami
+        // prefiksów.
+        constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+        // Nagłówek pliku migawki. Po nim jest capacity pozycji tablicy
+        // z adresowaniem otwartym i liniowym próbkowaniem, wypełnionej co
+        // najwyżej w połowie, a po niej część z regułami prefiksów. Liczby
+        // są zapisane w porządku bajtów maszyny.
+        struct snapshot_header {
+            char magic[8];
+            uint32_t version;
+            uint32_t entry_size;
+            uint64_t count;
+            uint64_t capacity;
+        };
+
+        // Pozycja tablicy migawki: zmiana numeru src na dst i ostateczny numer
+        // po ciągu zmian (lub CYCLE). Puste pozycje mają src zerowej długości.
+        struct snapshot_entry {
+            tel_key src;
+            tel_key dst;
+            tel_key final;
+        };
+
+        // Nagłówek części migawki z regułami prefiksów, po którym jest count
+        // reguł.
+        struct snapshot_prefix_header {
+            uint64_t count;
+            uint64_t reserved;
+        };
+
+        // Reguła zmiany prefiksu src na dst.
+        struct prefix_rule {
+            tel_key src;
+            tel_key dst;
+        };
+
+        static_assert(sizeof(snapshot_header) == 32 &&
+                      sizeof(snapshot_entry) == 48 &&
+                      sizeof(snapshot_prefix_header) == 16 &&
+                      sizeof(prefix_rule) == 32,
+                      "układ pliku migawki nie może zależeć od kompilatora");
+
+        // Plik migawki odwzorowany w pamięci tylko do odczytu. Strony są
+        // wczytywane dopiero przy pierwszym dostępie.
+        class snapshot {
+        public:
+            snapshot(void *data, size_t size) : data(data), size(size) {}
+
+            snapshot(snapshot const &) = delete;
+            snapshot &operator=(snapshot const &) = delete;
+
+            ~snapshot() {
+                munmap(data, size);
+            }
+
+            snapshot_header const &header() const {
+                return *static_cast<snapshot_header const *>(data);
+            }
+
+            snapshot_entry const *entries() const {
+                return reinterpret_cast<snapshot_entry const *>(
+                        static_cast<char const *>(data) +
+                        sizeof(snapshot_header));
+            }
+
+            size_t prefix_count() const {
+                return header().version < 2 ? 0 : prefix_header()->count;
+            }
+
+            prefix_rule const *prefix_rules() const {
+                return reinterpret_cast<prefix_rule const *>(
+                        prefix_header() + 1);
+            }
+
+            // Zwraca pozycję, od której zaczyna się szukanie numeru key.
+            size_t slot(tel_key key) const {
+                return hash_of_tel(key) & (header().capacity - 1);
+            }
+
+            // Zwraca pozycję zmiany numeru key lub nullptr, jeśli go nie
+            // zmieniano.
+            snapshot_entry const *find(tel_key key) const {
+                size_t mask = header().capacity - 1;
+
+                for (size_t i = slot(key);; i = (i + 1) & mask) {
+                    snapshot_entry const *entry = entries() + i;
+                    if (entry->src.length() == 0)
+                        return nullptr;
+                    if (entry->src == key)
+                        return entry;
+                }
+            }
+
+        private:
+            snapshot_prefix_header const *prefix_header() const {
+                return reinterpret_cast<snapshot_prefix_header const *>(
+                        entries() + header().capacity);
+            }
+
+            void *data;
+            size_t size;
+        };
+
+        // Liczba części blokady czytelników i pisarzy.
+        constexpr size_t LOCK_STRIPES = 16;
+
+        // Blokada czytelników i pisarzy podzielona na części w osobnych liniach
+        // pamięci podręcznej. Czytelnik blokuje tylko część przydzieloną jego
+        // wątkowi, więc czytelnicy z różnych wątków nie rywalizują o tę samą
+        // linię. Pisarz blokuje wszystkie części po kolei. Spełnia wymagania
+        // std::shared_lock i std::unique_lock.
+        class striped_mutex {
+        public:
+            void lock() {
+                for (stripe &s : stripes)
+                    s.mutex.lock();
+            }
+
+            void unlock() {
+                for (size_t i = LOCK_STRIPES; i-- > 0;)
+                    stripes[i].mutex.unlock();
+            }
+
+            void lock_shared() {
+                stripes[thread_stripe()].mutex.lock_shared();
+            }
+
+            void unlock_shared() {
+                stripes[thread_stripe()].mutex.unlock_shared();
+            }
+
+        private:
+            struct alignas(64) stripe {
+                std::shared_mutex mutex;
+            };
+
+            // Zwraca część blokady przydzieloną bieżącemu wątkowi. Kolejne
+            // wątki dostają kolejne części.
+            static size_t thread_stripe() {
+                static std::atomic<size_t> threads{0};
+                thread_local size_t const index = threads++ % LOCK_STRIPES;
+                return index;
+            }
+
+            std::array<stripe, LOCK_STRIPES> stripes;
+        };
+
+        using read_lock = std::shared_lock<striped_mutex>;
+        using write_lock = std::unique_lock<striped_mutex>;
+
+        // Liczba bitów haszu wybierających część indeksu ostatecznych numerów.
+        constexpr unsigned INDEX_SHARD_BITS = 6;
+        constexpr size_t INDEX_SHARDS = size_t(1) << INDEX_SHARD_BITS;
+
+        // Część indeksu ostatecznych numerów z numerami, których hasz na nią
+        // wskazuje. Czytelnicy słownika szukają w niej pod współdzieloną
+        // blokadą, a uzupełniają ją pod wyłączną, więc czekają na siebie
+        // tylko przy uzupełnianiu tej samej części. Pisarz słownika ma
+        // wyłączny dostęp i korzysta z niej bez blokady.
+        struct alignas(64) index_shard {
+            std::shared_mutex mutex;
+            // Ostateczny numer po ciągu zmian dla numerów, dla których go
+            // wyznaczono. Jeśli wyznaczono go dla numeru, to również dla
+            // kolejnych zmienianych numerów z jego ciągu zmian.
+            tel_map<tel_key> resolved;
+            // Numery, które reguły prefiksów zmieniły na dany numer podczas
+            // wyznaczania ostatecznych numerów. Uzupełnia sources słownika
+            // przy usuwaniu numerów z indeksu.
+            tel_map<tel_set> derived_sources;
+            // Numery z ciągów w indeksie, których kolejną zmianę wyznaczyły
+            // reguły prefiksów: zmieniła je reguła albo ciąg się na nich
+            // skończył, bo żadna nie pasowała. Tylko ich ciągi może zmienić
+            // zmiana reguł. Może zawierać numery, od których nic już nie
+            // zależy.
+            tel_ordered_set rule_tels;
+        };
+
+        class journal;
+
+        // Słownik zmian numerów z indeksem ich ostatecznych wartości.
+        struct dict {
+            // Chroni pozostałe pola. Czytelnicy mogą uzupełniać indeks pod
+            // blokadami jego części, a pozostałe zmiany wymagają blokady
+            // pisarza.
+            striped_mutex mutex;
+            // Numer, na który zmieniono dany numer, lub ERASED, jeśli
+            // usunięto zmianę zapisaną w migawce. Zmiany stąd zastępują
+            // zmiany z migawki.
+            tel_map<tel_key> changes;
+            // Numery, które zmieniono na dany numer w changes.
+            tel_map<tel_set> sources;
+            // Reguły zmiany prefiksów, stosowane do numerów bez zmiany.
+            prefix_trie prefixes;
+            // Indeks ostatecznych numerów podzielony według haszu numeru.
+            std::array<index_shard, INDEX_SHARDS> index;
+            // Stos numerów usuwanych z indeksu, trzymany między wywołaniami,
+            // aby nie przydzielać pamięci przy każdej zmianie.
+            vector<tel_key> pending;
+            // Migawka, z której wczytano słownik. Jej zmiany zostają tylko
+            // w niej, a changes trzyma zmiany wprowadzone później. Jest
+            // współdzielona z zapisem migawki, który czyta ją po zwolnieniu
+            // blokady.
+            std::shared_ptr<snapshot const> base;
+            // Czy ostateczne numery w migawce są aktualne, czyli słownika nie
+            // zmieniano od jej wczytania.
+            bool base_current = false;
+            // Czy indeks zapamiętuje, od których zmian i reguł zależą
+            // wyznaczone numery. Bez tego nie da się z niego usuwać numerów,
+            // co wystarcza słownikom, których się nie zmienia.
+            bool track_dependencies = true;
+            // Dziennik, do którego trafiają zmiany, jeśli go dołączono.
+            // Usuwany jako pierwszy, bo jego wątek korzysta ze słownika.
+            std::unique_ptr<journal> log;
+
+            ~dict();
+        };
+
+        // Wartość w indeksie oznaczająca, że ciąg zmian numeru tworzy cykl.
+        // Klucze o zerowej długości nie odpowiadają żadnemu numerowi.
+        constexpr tel_key CYCLE{0, 0};
+        // Wartość w changes oznaczająca usuniętą zmianę z migawki.
+        constexpr tel_key ERASED{0, 0};
+
+        // Liczba numerów, dla których maptel_transform_batch wyznacza klucze
+        // i pobiera z wyprzedzeniem pozycje migawki, zanim zacznie szukać.
+        constexpr size_t BATCH_CHUNK = 32;
+
+        // Tworzy mapę słowników. Słowniki są trzymane przez wskaźniki, aby
+        // można je było przygotować przed wzięciem blokady mapy.
+        unordered_map<ulong, std::unique_ptr<dict>> &dictionaries() {
+            static unordered_map<ulong, std::unique_ptr<dict>> dictionaries;
             return dictionaries;
         }
 
+        // Dodaje słownik i zwraca jego identyfikator. Wymaga blokady pisarza
+        // mapy słowników.
+        ulong add_dict(std::unique_ptr<dict> new_dict) {
+            static ulong maptel_count = 0;
+
+            ulong id_new_dict = maptel_count++;
+            dictionaries().try_emplace(id_new_dict, std::move(new_dict));
+            return id_new_dict;
+        }
+
+        // Tworzy blokadę mapy słowników. Tworzenie i usuwanie słownika wymaga
+        // blokady pisarza, a pozostałe operacje blokady czytelnika trzymanej
+        // przez cały czas korzystania ze słownika.
+        striped_mutex &dictionaries_mutex() {
+            static striped_mutex mutex;
+            return mutex;
+        }
+
         // Sprawdza, czy podany wskaźnik nie wskazuje na NULL.
         [[maybe_unused]] bool check_invalid_pointer(char const *tel,
                                                     char const *func_name) {
@@ -90,20 +654,1000 @@ namespace jnp1 {
             return dictionaries().find(id) != dictionaries().end();
         }
 
-        // Zwraca numer telefonu jako napis.
-        string string_of_tel(char const *tel) {
-            return string(tel);
+        // Zwraca część indeksu z numerem tel. Część wybierają najstarsze
+        // bity haszu, bo od najmłodszych zależy kubełek w jej mapach.
+        index_shard &shard_of(dict &d, tel_key tel) {
+            return d.index[hash_of_tel(tel) >> (64 - INDEX_SHARD_BITS)];
+        }
+
+        // Usuwa z indeksu numer tel i numery, których ciągi zmian przez niego
+        // przechodzą lub na nim kończą. Jeśli numeru nie ma w indeksie, to
+        // nie ma tam też numerów zmienionych na niego, chyba że jest to tel,
+        // który jest końcem ciągów. Wymaga blokady pisarza.
+        void invalidate(dict &d, tel_key tel) {
+            vector<tel_key> &stack = d.pending;
+            auto push_sources = [&](tel_key current) {
+                auto sources = d.sources.find(current);
+                if (sources != d.sources.end())
+                    stack.insert(stack.end(), sources->second.begin(),
+                                 sources->second.end());
+
+                // Po usunięciu poprzedników para nie jest już potrzebna.
+                tel_map<tel_set> &derived =
+                        shard_of(d, current).derived_sources;
+                auto derived_sources = derived.find(current);
+                if (derived_sources != derived.end()) {
+                    stack.insert(stack.end(), derived_sources->second.begin(),
+                                 derived_sources->second.end());
+                    derived.erase(derived_sources);
+                }
+            };
+
+            index_shard &shard = shard_of(d, tel);
+            shard.resolved.erase(tel);
+            shard.rule_tels.erase(tel);
+            push_sources(tel);
+
+            while (!stack.empty()) {
+                tel_key current = stack.back();
+                stack.pop_back();
+
+                index_shard &current_shard = shard_of(d, current);
+                if (current_shard.resolved.erase(current) == 0)
+                    continue;
+
+                current_shard.rule_tels.erase(current);
+                push_sources(current);
+            }
+        }
+
+        // Usuwa z indeksu numery, których ciągi zmian może zmienić zmiana
+        // reguły prefiksu prefix, czyli przechodzące przez numery z tym
+        // prefiksem, które zmieniła reguła lub na których się skończyły.
+        // Wymaga blokady pisarza.
+        void invalidate_prefix(dict &d, tel_key prefix) {
+            tel_key last = prefix;
+            while (last.length() < TEL_NUM_MAX_LEN)
+                last.push_back(9);
+
+            vector<tel_key> affected;
+            for (index_shard &shard : d.index) {
+                auto begin = shard.rule_tels.lower_bound(prefix);
+                auto end = shard.rule_tels.upper_bound(last);
+                affected.insert(affected.end(), begin, end);
+            }
+
+            for (tel_key tel : affected)
+                invalidate(d, tel);
+        }
+
+        // Usuwa z indeksu wszystkie numery. Wymaga blokady pisarza.
+        void invalidate_all(dict &d) {
+            for (index_shard &shard : d.index) {
+                shard.resolved.clear();
+                shard.derived_sources.clear();
+                shard.rule_tels.clear();
+            }
+        }
+
+        // Usuwa zmianę numeru tel_src, jeśli istnieje.
+        void remove_change(dict &d, tel_key tel_src) {
+            auto change = d.changes.find(tel_src);
+            if (change == d.changes.end())
+                return;
+
+            if (change->second != ERASED) {
+                auto sources = d.sources.find(change->second);
+                sources->second.erase(tel_src);
+                if (sources->second.empty())
+                    d.sources.erase(sources);
+            }
+
+            d.changes.erase(change);
+        }
+
+        // Zwraca true, jeśli numer tel_src jest zmieniony w changes lub
+        // w migawce.
+        bool has_change(dict const &d, tel_key tel_src) {
+            auto change = d.changes.find(tel_src);
+            if (change != d.changes.end())
+                return change->second != ERASED;
+            return d.base && d.base->find(tel_src) != nullptr;
+        }
+
+        // Przygotowuje słownik do pierwszej zmiany po wczytaniu migawki. Jej
+        // ostateczne numery przestają być aktualne, a numery wyznaczone na
+        // ich podstawie trzeba usunąć z indeksu, bo migawka nie zawiera
+        // zmian z reguł prefiksów, przez które przechodzą ciągi, a bez nich
+        // nie dałoby się ich usuwać pojedynczo. Sama migawka zostaje pod
+        // zmianami w changes. Wymaga blokady pisarza.
+        void leave_base(dict &d) {
+            if (!d.base_current)
+                return;
+
+            invalidate_all(d);
+            d.base_current = false;
+        }
+
+        // Sposób wyznaczenia kolejnej zmiany numeru.
+        enum step_kind {
+            // Numer się nie zmienia, bo nie pasuje do niego żadna reguła.
+            STEP_NONE,
+            // Zmiana z changes, zapisana w sources.
+            STEP_CHANGE,
+            // Zmiana z migawki.
+            STEP_BASE,
+            // Zmiana z reguły prefiksu.
+            STEP_RULE
+        };
+
+        // Zapisuje w next kolejną zmianę numeru tel: zapisaną dla niego
+        // w changes lub w migawce albo wynikającą z reguły prefiksu. Zwraca,
+        // skąd ją wziął.
+        step_kind next_tel(dict const &d, tel_key tel, tel_key &next) {
+            auto change = d.changes.find(tel);
+            if (change != d.changes.end() && change->second != ERASED) {
+                next = change->second;
+                return STEP_CHANGE;
+            }
+
+            if (change == d.changes.end() && d.base) {
+                snapshot_entry const *entry = d.base->find(tel);
+                if (entry != nullptr) {
+                    next = entry->dst;
+                    return STEP_BASE;
+                }
+            }
+
+            return !d.prefixes.empty() && d.prefixes.apply(tel, next)
+                   ? STEP_RULE : STEP_NONE;
+        }
+
+        // Zapisuje w result ostateczny numer numeru tel z indeksu lub
+        // migawki. Zwraca false, jeśli go tam nie ma.
+        bool known_final(dict &d, tel_key tel, tel_key &result) {
+            if (d.base_current) {
+                snapshot_entry const *entry = d.base->find(tel);
+                if (entry != nullptr) {
+                    result = entry->final;
+                    return true;
+                }
+            }
+
+            index_shard &shard = shard_of(d, tel);
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto cached = shard.resolved.find(tel);
+            if (cached == shard.resolved.end())
+                return false;
+
+            result = cached->second;
+            return true;
+        }
+
+        // Wyznacza ostateczny numer po ciągu zmian numeru tel_src i zapisuje
+        // go w indeksie dla wszystkich zmienianych numerów z ciągu. Zwraca
+        // CYCLE, jeśli zmiany tworzą cykl. Wystarcza mu blokada czytelnika,
+        // bo indeks zmienia tylko pod blokadami jego części. Cykl wykrywa
+        // algorytmem Brenta: porównuje kolejne numery z zapamiętanym, który
+        // po każdej potędze dwójki kroków zastępuje bieżącym.
+        tel_key resolve(dict &d, tel_key tel_src) {
+            tel_key result;
+            if (known_final(d, tel_src, result))
+                return result;
+
+            // Zmieniane numery ciągu i sposób ich zmiany.
+            vector<std::pair<tel_key, step_kind>> chain;
+            tel_key current = tel_src;
+            tel_key saved = tel_src;
+            size_t power = 1;
+            size_t steps = 0;
+            // Czy ciąg skończył się na numerze, do którego nie pasuje żadna
+            // reguła.
+            bool ended = false;
+
+            while (true) {
+                tel_key next;
+                step_kind step = next_tel(d, current, next);
+                if (step == STEP_NONE) {
+                    result = current;
+                    ended = true;
+                    break;
+                }
+
+                chain.emplace_back(current, step);
+                current = next;
+                if (current == saved) {
+                    result = CYCLE;
+                    break;
+                }
+                if (known_final(d, current, result))
+                    break;
+                if (++steps == power) {
+                    saved = current;
+                    power *= 2;
+                    steps = 0;
+                }
+            }
+
+            // Inny czytelnik mógł w tym czasie zapisać ten sam wynik.
+            for (size_t i = 0; i < chain.size(); ++i) {
+                auto [tel, step] = chain[i];
+                tel_key next = i + 1 < chain.size() ? chain[i + 1].first
+                                                    : current;
+                index_shard &shard = shard_of(d, tel);
+                {
+                    std::lock_guard<std::shared_mutex> lock(shard.mutex);
+                    shard.resolved.emplace(tel, result);
+                    if (step == STEP_RULE && d.track_dependencies)
+                        shard.rule_tels.insert(tel);
+                }
+                // Zmiany spoza changes nie mają pary w sources.
+                if (step != STEP_CHANGE && d.track_dependencies) {
+                    index_shard &next_shard = shard_of(d, next);
+                    std::lock_guard<std::shared_mutex> lock(next_shard.mutex);
+                    next_shard.derived_sources[next].insert(tel);
+                }
+            }
+
+            if (ended && !chain.empty() && d.track_dependencies) {
+                index_shard &shard = shard_of(d, current);
+                std::lock_guard<std::shared_mutex> lock(shard.mutex);
+                shard.rule_tels.insert(current);
+            }
+
+            return result;
+        }
+
+        // Zmiany słownika z ich ostatecznymi numerami i reguły prefiksów.
+        struct snapshot_data {
+            vector<snapshot_entry> changes;
+            vector<prefix_rule> prefixes;
+        };
+
+        // Kopia zmian słownika bez indeksu. Zmiany z migawki nie są
+        // kopiowane, bo migawka się nie zmienia.
+        struct dict_state {
+            std::shared_ptr<snapshot const> base;
+            bool base_current;
+            vector<std::pair<tel_key, tel_key>> changes;
+            vector<prefix_rule> prefixes;
+        };
+
+        // Kopiuje zmiany słownika. Trwa tyle, ile kopiowanie zmian spoza
+        // migawki, więc nadaje się do wykonania pod blokadą czytelnika.
+        dict_state copy_state(dict const &d) {
+            dict_state state{d.base, d.base_current, {}, {}};
+
+            state.changes.assign(d.changes.begin(), d.changes.end());
+            d.prefixes.for_each([&](tel_key src, tel_key dst) {
+                state.prefixes.push_back({src, dst});
+            });
+
+            return state;
+        }
+
+        // Zbiera zmiany z kopii słownika razem z ich ostatecznymi numerami.
+        // Nie wymaga żadnej blokady, bo ciągi zmian wyznacza w osobnym,
+        // tymczasowym słowniku.
+        snapshot_data collect_snapshot(dict_state const &state) {
+            snapshot_data data;
+            vector<snapshot_entry> &changes = data.changes;
+            snapshot const *base = state.base.get();
+
+            data.prefixes = state.prefixes;
+
+            if (state.base_current) {
+                changes.reserve(base->header().count);
+                for (size_t i = 0; i < base->header().capacity; ++i)
+                    if (base->entries()[i].src.length() != 0)
+                        changes.push_back(base->entries()[i]);
+                return data;
+            }
+
+            auto d = std::make_unique<dict>();
+            d->base = state.base;
+            d->track_dependencies = false;
+            d->changes.insert(state.changes.begin(), state.changes.end());
+            for (prefix_rule const &rule : state.prefixes)
+                d->prefixes.insert(rule.src, rule.dst);
+
+            for (size_t i = 0; base != nullptr &&
+                               i < base->header().capacity; ++i) {
+                snapshot_entry const &entry = base->entries()[i];
+                if (entry.src.length() != 0 &&
+                    d->changes.find(entry.src) == d->changes.end())
+                    changes.push_back({entry.src, entry.dst,
+                                       resolve(*d, entry.src)});
+            }
+            for (auto const &[src, dst] : state.changes)
+                if (dst != ERASED)
+                    changes.push_back({src, dst, resolve(*d, src)});
+
+            return data;
+        }
+
+        // Zapisuje size bajtów z data do pliku fd, ponawiając niepełne zapisy.
+        bool write_all(int fd, void const *data, size_t size) {
+            char const *next = static_cast<char const *>(data);
+
+            while (size > 0) {
+                ssize_t written = write(fd, next, size);
+                if (written < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                next += written;
+                size -= static_cast<size_t>(written);
+            }
+
+            return true;
+        }
+
+        // Utrwala na dysku katalog zawierający plik path, a więc również
+        // zmianę nazwy pliku w tym katalogu.
+        bool sync_parent_dir(char const *path) {
+            std::string dir(path);
+            size_t slash = dir.rfind('/');
+            dir = slash == std::string::npos ? "." : dir.substr(0, slash + 1);
+
+            int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd < 0)
+                return false;
+
+            bool synced = fsync(fd) == 0;
+            close(fd);
+            return synced;
+        }
+
+        // Zapisuje zmiany w pliku path w formacie migawki. Plik powstaje pod
+        // nazwą tymczasową i dopiero po utrwaleniu na dysku zastępuje
+        // poprzedni, więc przerwany zapis nie psuje istniejącej migawki.
+        bool write_snapshot(snapshot_data const &data, char const *path) {
+            vector<snapshot_entry> const &changes = data.changes;
+            uint64_t capacity = 1;
+            while (capacity < 2 * changes.size())
+                capacity *= 2;
+
+            vector<snapshot_entry> table(capacity, snapshot_entry{});
+            for (snapshot_entry const &entry : changes) {
+                size_t i = hash_of_tel(entry.src) & (capacity - 1);
+                while (table[i].src.length() != 0)
+                    i = (i + 1) & (capacity - 1);
+                table[i] = entry;
+            }
+
+            snapshot_header header{};
+            std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+            header.version = SNAPSHOT_VERSION;
+            header.entry_size = sizeof(snapshot_entry);
+            header.count = changes.size();
+            header.capacity = capacity;
+
+            snapshot_prefix_header prefix_header{};
+            prefix_header.count = data.prefixes.size();
+
+            std::string tmp_path = std::string(path) + ".tmp";
+            int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                return false;
+
+            bool written =
+                    write_all(fd, &header, sizeof header) &&
+                    write_all(fd, table.data(),
+                              capacity * sizeof(snapshot_entry)) &&
+                    write_all(fd, &prefix_header, sizeof prefix_header) &&
+                    write_all(fd, data.prefixes.data(),
+                              data.prefixes.size() * sizeof(prefix_rule)) &&
+                    fsync(fd) == 0;
+            written = close(fd) == 0 && written;
+
+            if (!written) {
+                std::remove(tmp_path.c_str());
+                return false;
+            }
+            return std::rename(tmp_path.c_str(), path) == 0 &&
+                   sync_parent_dir(path);
+        }
+
+        // Sprawdza, czy każdy półbajt słowa jest cyfrą. Dodanie 6 do półbajtu
+        // większego od 9 przenosi jedynkę do następnego półbajtu lub poza
+        // słowo, a do cyfry nie.
+        bool bcd_digits(uint64_t word) {
+            constexpr uint64_t SIXES = 0x6666666666666666ULL;
+            uint64_t sum = word + SIXES;
+            return sum >= word &&
+                   ((sum ^ word ^ SIXES) & 0x1111111111111110ULL) == 0;
+        }
+
+        // Sprawdza, czy klucz z pliku zapisuje numer od 1 do TEL_NUM_MAX_LEN
+        // cyfr, a bity poza cyframi są zerowe, tak jak w kluczach tworzonych
+        // przez key_of_tel.
+        bool valid_key(tel_key key) {
+            size_t length = key.length();
+            if (length == 0 || length > TEL_NUM_MAX_LEN)
+                return false;
+
+            uint64_t high_digits =
+                    key.high & ((uint64_t(1) << LENGTH_SHIFT) - 1);
+            uint64_t low_mask = length >= LOW_DIGITS
+                                ? ~uint64_t(0)
+                                : (uint64_t(1) << (length * 4)) - 1;
+            uint64_t high_mask =
+                    length <= LOW_DIGITS
+                    ? 0
+                    : (uint64_t(1) << ((length - LOW_DIGITS) * 4)) - 1;
+
+            return (key.low & ~low_mask) == 0 &&
+                   (high_digits & ~high_mask) == 0 &&
+                   bcd_digits(key.low) && bcd_digits(high_digits);
         }
 
-        // Zapisuje w tel_dst numer tel_src_s.
-        void update(string &tel_before_change, string &tel_src_s,
+        // Sprawdza pozycje tablicy migawki: zajęte muszą mieć poprawne
+        // numery, ich liczba musi się zgadzać z nagłówkiem, a co najmniej
+        // jedna pozycja musi być pusta, bo inaczej szukanie numeru spoza
+        // tablicy nigdy by się nie skończyło.
+        bool valid_entries(snapshot const &base) {
+            uint64_t occupied = 0;
+
+            for (size_t i = 0; i < base.header().capacity; ++i) {
+                snapshot_entry const &entry = base.entries()[i];
+                if (entry.src.length() == 0)
+                    continue;
+
+                if (!valid_key(entry.src) || !valid_key(entry.dst) ||
+                    (entry.final != CYCLE && !valid_key(entry.final)))
+                    return false;
+                ++occupied;
+            }
+
+            return occupied == base.header().count &&
+                   occupied < base.header().capacity;
+        }
+
+        // Odwzorowuje w pamięci plik migawki path. Zwraca nullptr, jeśli
+        // pliku nie da się otworzyć lub nie jest poprawną migawką.
+        std::unique_ptr<snapshot> map_snapshot(char const *path) {
+            int fd = open(path, O_RDONLY);
+            if (fd < 0)
+                return nullptr;
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 ||
+                static_cast<size_t>(st.st_size) < sizeof(snapshot_header)) {
+                close(fd);
+                return nullptr;
+            }
+
+            size_t size = static_cast<size_t>(st.st_size);
+            void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (data == MAP_FAILED)
+                return nullptr;
+
+            auto result = std::make_unique<snapshot>(data, size);
+            snapshot_header const &header = result->header();
+            uint64_t capacity = header.capacity;
+
+            if (std::memcmp(header.magic, SNAPSHOT_MAGIC,
+                            sizeof header.magic) != 0 ||
+                header.version < 1 || header.version > SNAPSHOT_VERSION ||
+                header.entry_size != sizeof(snapshot_entry) ||
+                capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+                header.count > capacity / 2 ||
+                capacity > (size - sizeof(snapshot_header)) /
+                           sizeof(snapshot_entry))
+                return nullptr;
+
+            size_t table_end = sizeof(snapshot_header) +
+                               capacity * sizeof(snapshot_entry);
+            if (!valid_entries(*result))
+                return nullptr;
+            if (header.version < 2)
+                return size == table_end ? std::move(result) : nullptr;
+
+            size_t rules_start = table_end + sizeof(snapshot_prefix_header);
+            if (size < rules_start ||
+                (size - rules_start) / sizeof(prefix_rule) !=
+                result->prefix_count() ||
+                (size - rules_start) % sizeof(prefix_rule) != 0)
+                return nullptr;
+
+            for (size_t i = 0; i < result->prefix_count(); ++i) {
+                prefix_rule const &rule = result->prefix_rules()[i];
+                if (!valid_key(rule.src) || !valid_key(rule.dst))
+                    return nullptr;
+            }
+
+            return result;
+        }
+
+        // Dołącza do pustego słownika migawkę base razem z jej regułami
+        // prefiksów.
+        void attach_snapshot(dict &d, std::unique_ptr<snapshot> base) {
+            for (size_t i = 0; i < base->prefix_count(); ++i)
+                d.prefixes.insert(base->prefix_rules()[i].src,
+                                  base->prefix_rules()[i].dst);
+
+            // Numery są szukane w przypadkowych miejscach tablicy.
+            madvise(const_cast<snapshot_header *>(&base->header()),
+                    sizeof(snapshot_header) + base->header().capacity *
+                                              sizeof(snapshot_entry),
+                    MADV_RANDOM);
+
+            d.base = std::move(base);
+            d.base_current = true;
+        }
+
+        // Rodzaj wpisu dziennika zmian.
+        enum journal_op : uint32_t {
+            JOURNAL_INSERT = 1,
+            JOURNAL_ERASE = 2,
+            JOURNAL_INSERT_PREFIX = 3,
+            JOURNAL_ERASE_PREFIX = 4
+        };
+
+        // Wpis dziennika zmian. Przy usunięciu zmiany lub reguły dst ma
+        // zerową długość.
+        // Suma kontrolna pozwala odrzucić wpis zapisany tylko częściowo.
+        struct journal_record {
+            uint32_t op;
+            uint32_t checksum;
+            tel_key src;
+            tel_key dst;
+        };
+
+        static_assert(sizeof(journal_record) == 40,
+                      "układ dziennika nie może zależeć od kompilatora");
+
+        // Najdłuższy czas oczekiwania zmian na zapisanie w dzienniku.
+        constexpr auto JOURNAL_FLUSH_INTERVAL = std::chrono::milliseconds(10);
+        // Liczba oczekujących wpisów, która wymusza zapis przed upływem
+        // JOURNAL_FLUSH_INTERVAL.
+        constexpr size_t JOURNAL_FLUSH_RECORDS = 4096;
+        // Liczba wpisów w pliku dziennika, po której jest on scalany
+        // z migawką.
+        constexpr uint64_t JOURNAL_COMPACT_RECORDS = uint64_t(1) << 22;
+        // Liczba wpisów wczytywanych naraz przy odtwarzaniu dziennika.
+        constexpr size_t JOURNAL_READ_RECORDS = 4096;
+
+        uint32_t checksum_of(journal_record const &record) {
+            uint64_t h = hash_of_tel(record.src) ^
+                         (hash_of_tel(record.dst) * 31) ^ record.op;
+            return static_cast<uint32_t>(h ^ (h >> 32));
+        }
+
+        // Dziennik zmian słownika. Zmiany trafiają do bufora, a osobny wątek
+        // zapisuje je do pliku grupami, z jednym wywołaniem fdatasync na
+        // grupę. Gdy plik urośnie, drugi wątek zapisuje słownik jako migawkę,
+        // a wątek zapisu w tym czasie nadal zapisuje kolejne grupy. Po
+        // zapisaniu migawki zastępuje plik nowym, zawierającym tylko wpisy
+        // dodane od skopiowania słownika do migawki.
+        class journal {
+        public:
+            journal(dict &owner, int fd, std::string snapshot_path,
+                    std::string journal_path, uint64_t file_records)
+                    : owner(owner), snapshot_path(std::move(snapshot_path)),
+                      journal_path(std::move(journal_path)), fd(fd),
+                      file_records(file_records),
+                      flusher(&journal::run, this),
+                      compactor(&journal::run_compactor, this) {}
+
+            journal(journal const &) = delete;
+            journal &operator=(journal const &) = delete;
+
+            // Zapisuje oczekujące wpisy i kończy wątki. Niedokończone
+            // scalanie jest porzucane, a plik zostaje ze wszystkimi wpisami.
+            ~journal() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wake.notify_one();
+                compact_wake.notify_one();
+                flusher.join();
+                compactor.join();
+                close(fd);
+            }
+
+            // Dodaje wpis do bufora. Wymaga blokady pisarza słownika.
+            void append(journal_op op, tel_key src, tel_key dst) {
+                journal_record record{op, 0, src, dst};
+                record.checksum = checksum_of(record);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                buffer.push_back(record);
+                ++appended;
+                if (buffer.size() >= JOURNAL_FLUSH_RECORDS)
+                    wake.notify_one();
+            }
+
+            // Czeka, aż wszystkie dodane dotąd wpisy zostaną utrwalone.
+            // Zwraca false, jeśli zapis dziennika się nie powiódł.
+            bool sync() {
+                std::unique_lock<std::mutex> lock(mutex);
+                uint64_t target = appended;
+
+                sync_requested = true;
+                wake.notify_one();
+                flushed.wait(lock, [&] { return durable >= target; });
+                return !failed;
+            }
+
+        private:
+            // Stan scalania dziennika z migawką.
+            enum compaction_phase {
+                // Brak scalania.
+                COMPACTION_IDLE,
+                // Wątek scalania zapisuje migawkę.
+                COMPACTION_WRITING,
+                // Migawka zapisana, plik czeka na zastąpienie.
+                COMPACTION_WRITTEN,
+                // Zapis migawki się nie powiódł.
+                COMPACTION_FAILED
+            };
+
+            // Zapisuje wpisy na końcu pliku i utrwala je na dysku. Wywoływana
+            // tylko przez wątek zapisu.
+            bool write_records(vector<journal_record> const &records) {
+                if (records.empty())
+                    return true;
+
+                if (!write_all(fd, records.data(),
+                               records.size() * sizeof(journal_record)) ||
+                    fdatasync(fd) != 0)
+                    return false;
+
+                file_records += records.size();
+                return true;
+            }
+
+            // Zapisuje bufor do pliku i powiadamia czekających na utrwalenie.
+            // W trakcie scalania zapamiętuje zapisane wpisy dla nowego pliku.
+            // Wymaga zablokowania mutex przez lock, który na czas zapisu
+            // zwalnia.
+            void flush(std::unique_lock<std::mutex> &lock) {
+                uint64_t target = appended;
+
+                writing.swap(buffer);
+                sync_requested = false;
+                lock.unlock();
+                bool written = write_records(writing);
+                lock.lock();
+
+                if (written && phase != COMPACTION_IDLE)
+                    since_cut.insert(since_cut.end(), writing.begin(),
+                                     writing.end());
+                writing.clear();
+
+                failed = failed || !written;
+                durable = target;
+                flushed.notify_all();
+            }
+
+            // Kopiuje słownik do zapisania jako migawkę i przekazuje go
+            // wątkowi scalania. Wpisy dodane przed skopiowaniem zapisuje do
+            // pliku, a późniejsze trafią do nowego pliku. Wymaga zablokowania
+            // mutex przez lock. Blokadę słownika bierze przed nią, tak jak
+            // append.
+            void start_compaction(std::unique_lock<std::mutex> &lock) {
+                dict_state state;
+
+                lock.unlock();
+                {
+                    read_lock dict_lock(owner.mutex);
+                    state = copy_state(owner);
+                    lock.lock();
+                }
+
+                flush(lock);
+                if (failed)
+                    return;
+
+                compacted = std::move(state);
+                phase = COMPACTION_WRITING;
+                compact_wake.notify_one();
+            }
+
+            // Zastępuje plik dziennika nowym, zawierającym wpisy dodane od
+            // skopiowania słownika do migawki. Jeśli proces przerwie się
+            // wcześniej, zostaje stary plik, a ponowne odtworzenie jego
+            // wpisów na nowej migawce daje ten sam słownik. Wywoływana tylko
+            // przez wątek zapisu.
+            bool replace_file() {
+                std::string tmp_path = journal_path + ".tmp";
+                int new_fd = open(tmp_path.c_str(),
+                                  O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+                if (new_fd < 0)
+                    return false;
+
+                bool replaced =
+                        write_all(new_fd, since_cut.data(),
+                                  since_cut.size() * sizeof(journal_record)) &&
+                        fdatasync(new_fd) == 0 &&
+                        std::rename(tmp_path.c_str(),
+                                    journal_path.c_str()) == 0;
+                if (!replaced) {
+                    close(new_fd);
+                    std::remove(tmp_path.c_str());
+                    return false;
+                }
+
+                sync_parent_dir(journal_path.c_str());
+                close(fd);
+                fd = new_fd;
+                file_records = since_cut.size();
+                return true;
+            }
+
+            // Kończy scalanie po zapisaniu migawki. Jeśli się nie powiodło,
+            // następne zaczyna dopiero, gdy plik urośnie o kolejne
+            // JOURNAL_COMPACT_RECORDS wpisów. Wymaga zablokowania mutex przez
+            // lock, który na czas zastępowania pliku zwalnia.
+            void finish_compaction(std::unique_lock<std::mutex> &lock) {
+                bool compacted_file = phase == COMPACTION_WRITTEN;
+
+                if (compacted_file) {
+                    lock.unlock();
+                    compacted_file = replace_file();
+                    lock.lock();
+                }
+
+                compact_at = compacted_file
+                             ? JOURNAL_COMPACT_RECORDS
+                             : file_records + JOURNAL_COMPACT_RECORDS;
+                since_cut.clear();
+                since_cut.shrink_to_fit();
+                phase = COMPACTION_IDLE;
+            }
+
+            void run() {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                while (true) {
+                    wake.wait_for(lock, JOURNAL_FLUSH_INTERVAL, [&] {
+                        return stopping || sync_requested ||
+                               buffer.size() >= JOURNAL_FLUSH_RECORDS;
+                    });
+
+                    if (!buffer.empty() || sync_requested)
+                        flush(lock);
+
+                    // Podczas zapisu mogły pojawić się kolejne wpisy.
+                    if (stopping) {
+                        if (buffer.empty())
+                            return;
+                    } else if (phase == COMPACTION_WRITTEN ||
+                               phase == COMPACTION_FAILED) {
+                        finish_compaction(lock);
+                    } else if (phase == COMPACTION_IDLE &&
+                               file_records >= compact_at && !failed) {
+                        start_compaction(lock);
+                    }
+                }
+            }
+
+            // Zapisuje migawki przekazane przez wątek zapisu. Ciągi zmian
+            // wyznacza na kopii słownika, więc nie blokuje ani słownika, ani
+            // zapisu kolejnych wpisów.
+            void run_compactor() {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                while (true) {
+                    compact_wake.wait(lock, [&] {
+                        return stopping || phase == COMPACTION_WRITING;
+                    });
+                    if (stopping)
+                        return;
+
+                    dict_state state = std::move(compacted);
+                    lock.unlock();
+                    bool written = write_snapshot(collect_snapshot(state),
+                                                  snapshot_path.c_str());
+                    lock.lock();
+
+                    phase = written ? COMPACTION_WRITTEN : COMPACTION_FAILED;
+                    wake.notify_one();
+                }
+            }
+
+            dict &owner;
+            std::string snapshot_path;
+            std::string journal_path;
+            // Plik, liczba wpisów w nim, liczba wpisów, od której jest
+            // scalany, i wpisy dodane od skopiowania słownika do migawki.
+            // Używane tylko przez wątek zapisu.
+            int fd;
+            uint64_t file_records;
+            uint64_t compact_at = JOURNAL_COMPACT_RECORDS;
+            vector<journal_record> since_cut;
+
+            // Chroni pola poniżej.
+            std::mutex mutex;
+            std::condition_variable wake;
+            std::condition_variable flushed;
+            std::condition_variable compact_wake;
+            // Wpisy czekające na zapis.
+            vector<journal_record> buffer;
+            // Wpisy zapisywane przez wątek zapisu, trzymane, aby nie
+            // przydzielać pamięci przy każdym zapisie.
+            vector<journal_record> writing;
+            // Liczba wszystkich dodanych i utrwalonych wpisów.
+            uint64_t appended = 0;
+            uint64_t durable = 0;
+            bool sync_requested = false;
+            bool stopping = false;
+            bool failed = false;
+            compaction_phase phase = COMPACTION_IDLE;
+            // Kopia słownika przekazywana wątkowi scalania.
+            dict_state compacted;
+
+            std::thread flusher;
+            std::thread compactor;
+        };
+
+        dict::~dict() = default;
+
+        // Zleca procesorowi pobranie do pamięci podręcznej pozycji migawki,
+        // od której zaczyna się szukanie klucza key. Jej adres wynika wprost
+        // z haszu, więc nie czeka na żaden inny odczyt.
+        void prefetch(snapshot const &base, tel_key key) {
+#if defined(__GNUC__)
+            __builtin_prefetch(base.entries() + base.slot(key));
+#else
+            (void) base;
+            (void) key;
+#endif
+        }
+
+        // Wstawia zmianę numeru tel_src na tel_dst. Wymaga blokady pisarza.
+        void insert_change(dict &d, tel_key tel_src, tel_key tel_dst) {
+            leave_base(d);
+            invalidate(d, tel_src);
+            remove_change(d, tel_src);
+            d.changes[tel_src] = tel_dst;
+            d.sources[tel_dst].insert(tel_src);
+
+            if (d.log)
+                d.log->append(JOURNAL_INSERT, tel_src, tel_dst);
+        }
+
+        // Usuwa zmianę numeru tel_src razem z indeksem numerów od niej
+        // zależnych. Zwraca false, jeśli numer nie był zmieniany. Wymaga
+        // blokady pisarza.
+        bool erase_change(dict &d, tel_key tel_src) {
+            if (!has_change(d, tel_src))
+                return false;
+
+            leave_base(d);
+            invalidate(d, tel_src);
+            remove_change(d, tel_src);
+            // Zmianę z migawki przesłania wpis w changes.
+            if (d.base && d.base->find(tel_src) != nullptr)
+                d.changes.emplace(tel_src, ERASED);
+
+            if (d.log)
+                d.log->append(JOURNAL_ERASE, tel_src, tel_key{0, 0});
+            return true;
+        }
+
+        // Wstawia regułę zmiany prefiksu src na dst. Wymaga blokady pisarza.
+        void insert_prefix_rule(dict &d, tel_key src, tel_key dst) {
+            leave_base(d);
+            d.prefixes.insert(src, dst);
+            invalidate_prefix(d, src);
+
+            if (d.log)
+                d.log->append(JOURNAL_INSERT_PREFIX, src, dst);
+        }
+
+        // Usuwa regułę prefiksu src. Zwraca false, jeśli jej nie było.
+        // Wymaga blokady pisarza.
+        bool erase_prefix_rule(dict &d, tel_key src) {
+            if (!d.prefixes.erase(src))
+                return false;
+            leave_base(d);
+            invalidate_prefix(d, src);
+
+            if (d.log)
+                d.log->append(JOURNAL_ERASE_PREFIX, src, tel_key{0, 0});
+            return true;
+        }
+
+        // Odtwarza w słowniku zmiany z pliku dziennika fd, czytając go po
+        // kolei, i zapisuje w records liczbę poprawnych wpisów. Plik obcina
+        // za ostatnim poprawnym wpisem, bo dalsze mogły zostać zapisane tylko
+        // częściowo. Zwraca false, jeśli odczyt się nie powiódł.
+        bool replay_journal(dict &d, int fd, uint64_t &records) {
+            vector<journal_record> chunk(JOURNAL_READ_RECORDS);
+            size_t chunk_bytes = chunk.size() * sizeof(journal_record);
+            size_t filled = 0;
+
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            records = 0;
+
+            while (true) {
+                ssize_t got = read(fd, reinterpret_cast<char *>(chunk.data()) +
+                                       filled, chunk_bytes - filled);
+                if (got < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+
+                filled += static_cast<size_t>(got);
+                size_t complete = filled / sizeof(journal_record);
+                bool torn = false;
+
+                for (size_t i = 0; i < complete && !torn; ++i) {
+                    journal_record const &record = chunk[i];
+                    bool valid = record.checksum == checksum_of(record) &&
+                                 record.src.length() != 0;
+
+                    if (valid && record.op == JOURNAL_INSERT &&
+                        record.dst.length() != 0)
+                        insert_change(d, record.src, record.dst);
+                    else if (valid && record.op == JOURNAL_ERASE)
+                        erase_change(d, record.src);
+                    else if (valid && record.op == JOURNAL_INSERT_PREFIX &&
+                             record.dst.length() != 0)
+                        insert_prefix_rule(d, record.src, record.dst);
+                    else if (valid && record.op == JOURNAL_ERASE_PREFIX)
+                        erase_prefix_rule(d, record.src);
+                    else
+                        torn = true;
+
+                    records += !torn;
+                }
+
+                if (got == 0 || torn)
+                    break;
+                filled -= complete * sizeof(journal_record);
+                std::memmove(chunk.data(), chunk.data() + complete, filled);
+            }
+
+            return ftruncate(fd, static_cast<off_t>(
+                    records * sizeof(journal_record))) == 0;
+        }
+
+        // Zwraca ostateczny numer po ciągu zmian numeru tel_src lub CYCLE.
+        // Nawet gdy uzupełnia indeks, bierze tylko blokadę czytelnika.
+        tel_key transform_key(dict &d, tel_key tel_src) {
+            read_lock lock(d.mutex);
+            return resolve(d, tel_src);
+        }
+
+        // Zwraca klucz poprawnego numeru telefonu.
+        tel_key key_of_tel(char const *tel) {
+            tel_key key{0, 0};
+            size_t i;
+
+            for (i = 0; i < LOW_DIGITS && tel[i] != 0; ++i)
+                key.low |= static_cast<uint64_t>(tel[i] - '0') << (i * 4);
+            for (; tel[i] != 0; ++i)
+                key.high |= static_cast<uint64_t>(tel[i] - '0')
+                            << ((i - LOW_DIGITS) * 4);
+
+            key.high |= static_cast<uint64_t>(i) << LENGTH_SHIFT;
+            return key;
+        }
+
+        // Wypisuje cyfry numeru zapisanego w kluczu.
+        std::ostream &operator<<(std::ostream &os, tel_key const &key) {
+            for (size_t i = 0; i < key.length(); ++i)
+                os << key.digit(i);
+            return os;
+        }
+
+        // Zapisuje w tel_dst numer tel_src_key.
+        void update(tel_key tel_before_change, tel_key tel_src_key,
                     char *tel_dst, [[maybe_unused]] size_t len) {
-            assert(len > tel_src_s.size()); // Miejsce na znak '\0'.
+            size_t tel_src_size = tel_src_key.length();
 
-            size_t tel_src_size = tel_src_s.size();
+            assert(len > tel_src_size); // Miejsce na znak '\0'.
 
             for (size_t i = 0; i < tel_src_size; ++i)
-                tel_dst[i] = tel_src_s[i];
+                tel_dst[i] = tel_src_key.digit(i);
 
             tel_dst[tel_src_size] = 0;
 
@@ -114,13 +1658,13 @@ namespace jnp1 {
     }
 
     ulong maptel_create(void) {
-        static ulong maptel_count = 0;
-
         if (DEBUG)
             std::cerr << "maptel: maptel_create()\n";
 
-        ulong id_new_dict = maptel_count;
-        dictionaries()[maptel_count++] = dict();
+        auto new_dict = std::make_unique<dict>();
+        write_lock lock(dictionaries_mutex());
+
+        ulong id_new_dict = add_dict(std::move(new_dict));
 
         if (DEBUG)
             std::cerr << "maptel: maptel_create: new map id = "
@@ -133,12 +1677,22 @@ namespace jnp1 {
         if (DEBUG)
             std::cerr << "maptel: maptel_delete(" << id_of_deleted << ")\n";
 
-        assert(dict_of_id_exists(id_of_deleted));
+        std::unique_ptr<dict> deleted;
 
-        auto rem = dictionaries().find(id_of_deleted);
+        {
+            write_lock lock(dictionaries_mutex());
+
+            assert(dict_of_id_exists(id_of_deleted));
+
+            auto rem = dictionaries().find(id_of_deleted);
+
+            // Dziennik zapisuje przy usuwaniu oczekujące wpisy, co nie
+            // powinno wstrzymywać innych słowników.
+            deleted = std::move(rem->second);
+            dictionaries().erase(rem);
+        }
 
-        rem->second.clear();
-        dictionaries().erase(rem);
+        deleted.reset();
 
         if (DEBUG)
             std::cerr << "maptel: maptel_delete: map "
@@ -150,14 +1704,18 @@ namespace jnp1 {
             std::cerr << "maptel: maptel_insert("
                       << id << ", " << tel_src << ", " << tel_dst << ")\n";
 
+        read_lock dictionaries_lock(dictionaries_mutex());
+
         assert(dict_of_id_exists(id));
         assert(!check_invalid_tel(tel_src, "maptel_insert") &&
                !check_invalid_tel(tel_dst, "maptel_insert"));
 
-        string tel_src_s = string_of_tel(tel_src);
-        string tel_dst_s = string_of_tel(tel_dst);
-        auto dictionary = dictionaries().find(id);
-        dictionary->second[tel_src_s] = tel_dst_s;
+        tel_key tel_src_key = key_of_tel(tel_src);
+        tel_key tel_dst_key = key_of_tel(tel_dst);
+        dict &d = *dictionaries().find(id)->second;
+        write_lock lock(d.mutex);
+
+        insert_change(d, tel_src_key, tel_dst_key);
 
         if (DEBUG)
             std::cerr << "maptel: maptel_insert: inserted\n";
@@ -168,24 +1726,21 @@ namespace jnp1 {
             std::cerr << "maptel: maptel_erase("
                       << id << ", " << tel_src << ")\n";
 
+        read_lock dictionaries_lock(dictionaries_mutex());
+
         assert(dict_of_id_exists(id));
         assert(!check_invalid_tel(tel_src, "maptel_erase"));
 
-        string tel_src_s = string_of_tel(tel_src);
-        auto dictionary = dictionaries().find(id);
-        auto tel_dst_ptr = dictionary->second.find(tel_src_s);
-
-        if (tel_dst_ptr == dictionary->second.end()) {
-            if (DEBUG)
-                std::cerr << "maptel: maptel_erase: nothing to erase\n";
-
-            return; // Jeśli numer nie był zmieniany, to funkcja nic nie robi.
-        }
+        tel_key tel_src_key = key_of_tel(tel_src);
+        dict &d = *dictionaries().find(id)->second;
+        write_lock lock(d.mutex);
 
-        dictionary->second.erase(tel_dst_ptr);
+        // Jeśli numer nie był zmieniany, to funkcja nic nie robi.
+        bool erased = erase_change(d, tel_src_key);
 
         if (DEBUG)
-            std::cerr << "maptel: maptel_erase: erased\n";
+            std::cerr << "maptel: maptel_erase: "
+                      << (erased ? "erased\n" : "nothing to erase\n");
     }
 
     void maptel_transform(ulong id, char const *tel_src, char *tel_dst,
@@ -194,35 +1749,311 @@ namespace jnp1 {
             std::cerr << "maptel: maptel_transform(" << id << ", " << tel_src
                       << ", " << &tel_dst << ", " << len << ")\n";
 
+        read_lock dictionaries_lock(dictionaries_mutex());
+
         assert(dict_of_id_exists(id));
         assert(!check_invalid_tel(tel_src, "maptel_transform") &&
                !check_invalid_pointer(tel_dst, "maptel_transform"));
 
-        string tel_src_s = string_of_tel(tel_src);
-        unordered_set<string> visited_numbers; // Zbiór przejrzanych telefonów.
-        dict &dict_of_id = dictionaries()[id];
-        auto phone_number = dict_of_id.find(tel_src_s);
-        string new_tel = (phone_number == dict_of_id.end()) ?
-                         tel_src_s : dict_of_id[tel_src_s];
-        bool cycle = false;
+        tel_key tel_src_key = key_of_tel(tel_src);
+        dict &d = *dictionaries().find(id)->second;
+        // W typowym przypadku numer jest już w indeksie.
+        tel_key new_tel = transform_key(d, tel_src_key);
+        bool cycle = new_tel == CYCLE;
+
+        if (cycle) {
+            if (DEBUG)
+                std::cerr << "maptel: maptel_transform: cycle detected\n";
+
+            update(tel_src_key, tel_src_key, tel_dst, len);
+        } else {
+            update(tel_src_key, new_tel, tel_dst, len);
+        }
+    }
+
+    void maptel_insert_batch(ulong id, size_t count, char const *const *tel_src,
+                             char const *const *tel_dst) {
+        if (DEBUG)
+            std::cerr << "maptel: maptel_insert_batch("
+                      << id << ", " << count << ")\n";
+
+        read_lock dictionaries_lock(dictionaries_mutex());
+
+        assert(dict_of_id_exists(id));
+        assert(count == 0 || (tel_src != nullptr && tel_dst != nullptr));
+
+        dict &d = *dictionaries().find(id)->second;
+        write_lock lock(d.mutex);
+
+        for (size_t i = 0; i < count; ++i) {
+            assert(!check_invalid_tel(tel_src[i], "maptel_insert_batch") &&
+                   !check_invalid_tel(tel_dst[i], "maptel_insert_batch"));
+
+            insert_change(d, key_of_tel(tel_src[i]), key_of_tel(tel_dst[i]));
+        }
+
+        if (DEBUG)
+            std::cerr << "maptel: maptel_insert_batch: inserted "
+                      << count << "\n";
+    }
+
+    void maptel_erase_batch(ulong id, size_t count,
+                            char const *const *tel_src) {
+        if (DEBUG)
+            std::cerr << "maptel: maptel_erase_batch("
+                      << id << ", " << count << ")\n";
+
+        read_lock dictionaries_lock(dictionaries_mutex());
+
+        assert(dict_of_id_exists(id));
+        assert(count == 0 || tel_src != nullptr);
+
+        dict &d = *dictionaries().find(id)->second;
+        write_lock lock(d.mutex);
+        size_t erased = 0;
+
+        for (size_t i = 0; i < count; ++i) {
+            assert(!check_invalid_tel(tel_src[i], "maptel_erase_batch"));
+
+            erased += erase_change(d, key_of_tel(tel_src[i]));
+        }
+
+        if (DEBUG)
+            std::cerr << "maptel: maptel_erase_batch: erased "
+                      << erased << "\n";
+    }
+
+    void maptel_transform_batch(ulong id, size_t count,
+                                char const *const *tel_src,
+                                char *const *tel_dst, size_t len) {
+        if (DEBUG)
+            std::cerr << "maptel: maptel_transform_batch(" << id << ", "
+                      << count << ", " << len << ")\n";
+
+        read_lock dictionaries_lock(dictionaries_mutex());
+
+        assert(dict_of_id_exists(id));
+        assert(count == 0 || (tel_src != nullptr && tel_dst != nullptr));
+
+        dict &d = *dictionaries().find(id)->second;
+        std::array<tel_key, BATCH_CHUNK> src_keys, new_tels;
 
-        while (phone_number != dict_of_id.end() && !cycle) {
-            visited_numbers.insert(new_tel);
-            phone_number = dict_of_id.find(new_tel);
+        for (size_t start = 0; start < count; start += BATCH_CHUNK) {
+            size_t chunk = std::min(BATCH_CHUNK, count - start);
 
-            if (phone_number != dict_of_id.end()) {
-                new_tel = phone_number->second;
-                cycle = visited_numbers.find(new_tel) != visited_numbers.end();
+            for (size_t i = 0; i < chunk; ++i) {
+                assert(!check_invalid_tel(tel_src[start + i],
+                                          "maptel_transform_batch") &&
+                       !check_invalid_pointer(tel_dst[start + i],
+                                              "maptel_transform_batch"));
+
+                src_keys[i] = key_of_tel(tel_src[start + i]);
+            }
+
+            {
+                read_lock lock(d.mutex);
+
+                if (d.base)
+                    for (size_t i = 0; i < chunk; ++i)
+                        prefetch(*d.base, src_keys[i]);
+
+                for (size_t i = 0; i < chunk; ++i)
+                    new_tels[i] = resolve(d, src_keys[i]);
+            }
+
+            for (size_t i = 0; i < chunk; ++i) {
+                if (new_tels[i] == CYCLE) {
+                    if (DEBUG)
+                        std::cerr << "maptel: maptel_transform_batch: "
+                                  << "cycle detected\n";
+
+                    new_tels[i] = src_keys[i];
+                }
+
+                update(src_keys[i], new_tels[i], tel_dst[start + i], len);
             }
         }
+    }
 
-        if (cycle) {
+    int maptel_save(ulong id, char const *path) {
+        if (DEBUG)
+            std::cerr << "maptel: maptel_save(" << id << ", "
+                      << (path != nullptr ? path : "NULL") << ")\n";
+
+        read_lock dictionaries_lock(dictionaries_mutex());
+
+        assert(dict_of_id_exists(id));
+        assert(path != nullptr);
+
+        dict &d = *dictionaries().find(id)->second;
+        dict_state state;
+
+        {
+            read_lock lock(d.mutex);
+            state = copy_state(d);
+        }
+
+        bool saved = write_snapshot(collect_snapshot(state), path);
+
+        if (DEBUG)
+            std::cerr << "maptel: maptel_save: "
+                      << (saved ? "saved\n" : "cannot write file\n");
+
+        return saved ? 0 : -1;
+    }
+
+    ulong maptel_load(char const *path) {
+        if (DEBUG)
+            std::cerr << "maptel: maptel_load("
+                      << (path != nullptr ? path : "NULL") << ")\n";
+
+        assert(path != nullptr);
+
+        std::unique_ptr<snapshot> base = map_snapshot(path);
+        if (!base) {
             if (DEBUG)
-                std::cerr << "maptel: maptel_transform: cycle detected\n";
+                std::cerr << "maptel: maptel_load: invalid snapshot\n";
 
-            update(tel_src_s, tel_src_s, tel_dst, len);
-        } else {
-            update(tel_src_s, new_tel, tel_dst, len);
+            return MAPTEL_LOAD_FAILED;
         }
+
+        auto new_dict = std::make_unique<dict>();
+        attach_snapshot(*new_dict, std::move(base));
+
+        write_lock lock(dictionaries_mutex());
+
+        ulong id_new_dict = add_dict(std::move(new_dict));
+
+        if (DEBUG)
+            std::cerr << "maptel: maptel_load: new map id = "
+                      << id_new_dict << "\n";
+
+        return id_new_dict;
+    }
+
+    ulong maptel_open_journaled(char const *snapshot_path,
+                                char const *journal_path) {
+        if (DEBUG)
+            std::cerr << "maptel: maptel_open_journaled("
+                      << (snapshot_path != nullptr ? snapshot_path : "NULL")
+                      << ", "
+                      << (journal_path != nullptr ? journal_path : "NULL")
+                      << ")\n";
+
+        assert(snapshot_path != nullptr && journal_path != nullptr);
+
+        // Brak migawki oznacza pusty słownik, ale niepoprawna migawka to błąd.
+        std::unique_ptr<snapshot> base = map_snapshot(snapshot_path);
+        bool no_snapshot = !base && access(snapshot_path, F_OK) != 0 &&
+                           errno == ENOENT;
+        // Dopisywanie na końcu pliku jest poprawne także po jego obcięciu.
+        int fd = open(journal_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+        if ((!base && !no_snapshot) || fd < 0) {
+            if (fd >= 0)
+                close(fd);
+            if (DEBUG)
+                std::cerr << "maptel: maptel_open_journaled: "
+                          << "cannot open files\n";
+
+            return MAPTEL_LOAD_FAILED;
+        }
+
+        // Słownik jest odtwarzany przed wzięciem blokady mapy słowników, aby
+        // nie wstrzymywać pozostałych.
+        auto new_dict = std::make_unique<dict>();
+        uint64_t records;
+
+        if (base)
+            attach_snapshot(*new_dict, std::move(base));
+        if (!replay_journal(*new_dict, fd, records)) {
+            close(fd);
+            if (DEBUG)
+                std::cerr << "maptel: maptel_open_journaled: "
+                          << "cannot read journal\n";
+
+            return MAPTEL_LOAD_FAILED;
+        }
+
+        new_dict->log = std::make_unique<journal>(*new_dict, fd,
+                                                  snapshot_path, journal_path,
+                                                  records);
+
+        write_lock lock(dictionaries_mutex());
+
+        ulong id_new_dict = add_dict(std::move(new_dict));
+
+        if (DEBUG)
+            std::cerr << "maptel: maptel_open_journaled: replayed " << records
+                      << ", new map id = " << id_new_dict << "\n";
+
+        return id_new_dict;
+    }
+
+    int maptel_journal_sync(ulong id) {
+        if (DEBUG)
+            std::cerr << "maptel: maptel_journal_sync(" << id << ")\n";
+
+        read_lock dictionaries_lock(dictionaries_mutex());
+
+        assert(dict_of_id_exists(id));
+
+        dict &d = *dictionaries().find(id)->second;
+        journal *log;
+
+        {
+            read_lock lock(d.mutex);
+            log = d.log.get();
+        }
+
+        bool synced = log == nullptr || log->sync();
+
+        if (DEBUG)
+            std::cerr << "maptel: maptel_journal_sync: "
+                      << (synced ? "synced\n" : "write failed\n");
+
+        return synced ? 0 : -1;
+    }
+
+    void maptel_insert_prefix(ulong id, char const *src_prefix,
+                              char const *dst_prefix) {
+        if (DEBUG)
+            std::cerr << "maptel: maptel_insert_prefix(" << id << ", "
+                      << src_prefix << ", " << dst_prefix << ")\n";
+
+        read_lock dictionaries_lock(dictionaries_mutex());
+
+        assert(dict_of_id_exists(id));
+        assert(!check_invalid_tel(src_prefix, "maptel_insert_prefix") &&
+               !check_invalid_tel(dst_prefix, "maptel_insert_prefix"));
+
+        dict &d = *dictionaries().find(id)->second;
+        write_lock lock(d.mutex);
+
+        insert_prefix_rule(d, key_of_tel(src_prefix), key_of_tel(dst_prefix));
+
+        if (DEBUG)
+            std::cerr << "maptel: maptel_insert_prefix: inserted\n";
+    }
+
+    void maptel_erase_prefix(ulong id, char const *src_prefix) {
+        if (DEBUG)
+            std::cerr << "maptel: maptel_erase_prefix("
+                      << id << ", " << src_prefix << ")\n";
+
+        read_lock dictionaries_lock(dictionaries_mutex());
+
+        assert(dict_of_id_exists(id));
+        assert(!check_invalid_tel(src_prefix, "maptel_erase_prefix"));
+
+        dict &d = *dictionaries().find(id)->second;
+        write_lock lock(d.mutex);
+
+        // Jeśli nie było reguły dla prefiksu, to funkcja nic nie robi.
+        bool erased = erase_prefix_rule(d, key_of_tel(src_prefix));
+
+        if (DEBUG)
+            std::cerr << "maptel: maptel_erase_prefix: "
+                      << (erased ? "erased\n" : "nothing to erase\n");
     }
 }
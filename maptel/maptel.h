@@ -12,6 +12,9 @@
 
 const size_t TEL_NUM_MAX_LEN = 22;
 
+// Identyfikator zwracany przez maptel_load, gdy nie udało się wczytać pliku.
+const unsigned long MAPTEL_LOAD_FAILED = (unsigned long) -1;
+
 // Tworzy słownik i zwraca liczbę naturalną będącą jego identyfikatorem.
 unsigned long maptel_create(void);
  
@@ -30,9 +33,67 @@ void maptel_erase(unsigned long id, char const *tel_src);
 // tel_src. Podąża ciągiem kolejnych zmian. Zapisuje zmieniony numer w tel_dst.
 // Jeśli nie ma zmiany numeru lub zmiany tworzą cykl, to zapisuje w tel_dst
 // numer tel_src. Wartość len to rozmiar przydzielonej pamięci wskazywanej
-// przez tel_dst.
+// przez tel_dst. Numer bez zapisanej zmiany zmienia reguła najdłuższego
+// pasującego prefiksu spośród tych, po których zastosowaniu numer ma co
+// najwyżej TEL_NUM_MAX_LEN cyfr.
 void maptel_transform(unsigned long id, char const *tel_src, char *tel_dst, size_t len);
 
+// Wstawia do słownika o identyfikatorze id regułę zmiany numerów
+// zaczynających się od src_prefix: prefiks src_prefix jest w nich zastępowany
+// przez dst_prefix. Reguła nie dotyczy numerów, dla których zapisano zmianę
+// funkcją maptel_insert. Nadpisuje ewentualną istniejącą regułę dla
+// src_prefix.
+void maptel_insert_prefix(unsigned long id, char const *src_prefix,
+                          char const *dst_prefix);
+
+// Jeśli w słowniku o identyfikatorze id jest reguła dla prefiksu src_prefix,
+// to ją usuwa. W przeciwnym przypadku nic nie robi.
+void maptel_erase_prefix(unsigned long id, char const *src_prefix);
+
+// Wykonuje maptel_insert(id, tel_src[i], tel_dst[i]) dla kolejnych i
+// mniejszych od count.
+void maptel_insert_batch(unsigned long id, size_t count,
+                         char const *const *tel_src,
+                         char const *const *tel_dst);
+
+// Wykonuje maptel_erase(id, tel_src[i]) dla kolejnych i mniejszych od count.
+void maptel_erase_batch(unsigned long id, size_t count,
+                        char const *const *tel_src);
+
+// Wykonuje maptel_transform(id, tel_src[i], tel_dst[i], len) dla kolejnych i
+// mniejszych od count. Każdy z buforów tel_dst[i] ma rozmiar len.
+void maptel_transform_batch(unsigned long id, size_t count,
+                            char const *const *tel_src, char *const *tel_dst,
+                            size_t len);
+
+// Zapisuje słownik o identyfikatorze id w pliku path jako migawkę, którą
+// można wczytać funkcją maptel_load. Zwraca 0 lub -1, jeśli zapis się nie
+// powiódł. Poprzednia zawartość pliku jest zastępowana dopiero po zapisaniu
+// całej migawki.
+int maptel_save(unsigned long id, char const *path);
+
+// Tworzy słownik z migawki zapisanej w pliku path i zwraca jego
+// identyfikator lub MAPTEL_LOAD_FAILED, jeśli plik nie jest poprawną
+// migawką. Plik jest odwzorowywany w pamięci i przy wczytaniu raz czytany
+// w całości, aby sprawdzić jego poprawność. Późniejsze modyfikacje słownika
+// są trzymane w pamięci ponad migawką. Plik nie może być zmieniany, dopóki
+// słownik go używa.
+unsigned long maptel_load(char const *path);
+
+// Tworzy słownik z migawki snapshot_path (albo pusty, jeśli plik nie istnieje)
+// i odtwarza w nim zmiany z dziennika journal_path. Kolejne zmiany słownika
+// są dopisywane do dziennika w tle, grupami, co najwyżej kilka milisekund po
+// wykonaniu. Gdy dziennik urośnie, jest w tle scalany w nową migawkę
+// snapshot_path. Zwraca identyfikator słownika lub MAPTEL_LOAD_FAILED, jeśli
+// plików nie da się odczytać.
+unsigned long maptel_open_journaled(char const *snapshot_path,
+                                    char const *journal_path);
+
+// Czeka, aż wszystkie dotychczasowe zmiany słownika o identyfikatorze id
+// zostaną utrwalone w jego dzienniku. Zwraca 0 lub -1, jeśli zapis dziennika
+// się nie powiódł. Dla słownika bez dziennika od razu zwraca 0.
+int maptel_journal_sync(unsigned long id);
+
 #ifdef __cplusplus
     }
 }
@@ -0,0 +1,294 @@
+// Testy migawek i dziennika słownika maptel. Kompilacja i uruchomienie:
+// g++ -std=c++17 -pthread maptel_test.cc maptel.cc -o maptel_test
+// ./maptel_test
+
+#undef NDEBUG
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "maptel.h"
+
+using namespace jnp1;
+
+namespace {
+    // Położenie pól w pliku migawki, zgodne z maptel.cc.
+    constexpr size_t HEADER_SIZE = 32;
+    constexpr size_t COUNT_OFFSET = 16;
+    constexpr size_t ENTRY_SIZE = 48;
+    constexpr size_t KEY_SIZE = 16;
+    // Najstarszy bajt klucza to długość numeru.
+    constexpr size_t LENGTH_OFFSET = 15;
+    // Położenie pól we wpisie dziennika.
+    constexpr size_t RECORD_SIZE = 40;
+    constexpr size_t CHECKSUM_OFFSET = 4;
+    // Liczba wpisów zapisywanych przez write_journal.
+    constexpr size_t JOURNAL_RECORDS = 4;
+
+    std::string dir;
+
+    std::string path_of(char const *name) {
+        return dir + "/" + name;
+    }
+
+    std::vector<char> read_file(std::string const &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in),
+                                 std::istreambuf_iterator<char>());
+    }
+
+    void write_file(std::string const &path, std::vector<char> const &data) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        assert(out.good());
+    }
+
+    std::string transform(unsigned long id, char const *tel) {
+        char out[TEL_NUM_MAX_LEN + 1];
+        maptel_transform(id, tel, out, sizeof out);
+        return out;
+    }
+
+    uint64_t capacity_of(std::vector<char> const &data) {
+        uint64_t capacity;
+        std::memcpy(&capacity, data.data() + COUNT_OFFSET + 8,
+                    sizeof capacity);
+        return capacity;
+    }
+
+    // Zwraca położenie pierwszej zajętej pozycji tablicy migawki.
+    size_t first_entry(std::vector<char> const &data) {
+        for (size_t i = 0; i < capacity_of(data); ++i) {
+            size_t offset = HEADER_SIZE + i * ENTRY_SIZE;
+            if (data[offset + LENGTH_OFFSET] != 0)
+                return offset;
+        }
+        assert(false);
+        return 0;
+    }
+
+    // Zapisuje słownik z kilkoma zmianami i regułą prefiksu.
+    std::vector<char> saved_snapshot(std::string const &path) {
+        unsigned long id = maptel_create();
+        maptel_insert(id, "123", "456");
+        maptel_insert(id, "456", "789");
+        maptel_insert(id, "111", "222");
+        maptel_insert_prefix(id, "99", "88");
+        assert(maptel_save(id, path.c_str()) == 0);
+        maptel_delete(id);
+        return read_file(path);
+    }
+
+    void expect_load_failed(std::vector<char> const &data) {
+        std::string path = path_of("corrupted");
+        write_file(path, data);
+        assert(maptel_load(path.c_str()) == MAPTEL_LOAD_FAILED);
+    }
+
+    // Zapisuje migawkę z saved_snapshot i dziennik z JOURNAL_RECORDS
+    // wpisami, które ją zmieniają.
+    void write_journal(std::string const &snapshot_path,
+                       std::string const &journal_path) {
+        saved_snapshot(snapshot_path);
+        unlink(journal_path.c_str());
+
+        unsigned long id = maptel_open_journaled(snapshot_path.c_str(),
+                                                 journal_path.c_str());
+        assert(id != MAPTEL_LOAD_FAILED);
+        maptel_insert(id, "789", "1000");
+        maptel_erase(id, "111");
+        maptel_erase_prefix(id, "99");
+        maptel_insert(id, "5", "6");
+        assert(maptel_journal_sync(id) == 0);
+        maptel_delete(id);
+    }
+
+    // Sprawdza słownik po odtworzeniu records pierwszych wpisów
+    // z write_journal.
+    void expect_replayed(unsigned long id, size_t records) {
+        assert(id != MAPTEL_LOAD_FAILED);
+        assert(transform(id, "123") == (records >= 1 ? "1000" : "789"));
+        assert(transform(id, "111") == (records >= 2 ? "111" : "222"));
+        assert(transform(id, "995") == (records >= 3 ? "995" : "885"));
+        assert(transform(id, "5") == (records >= 4 ? "6" : "5"));
+    }
+
+    unsigned long open_journal(std::string const &snapshot_path,
+                               std::string const &journal_path) {
+        return maptel_open_journaled(snapshot_path.c_str(),
+                                     journal_path.c_str());
+    }
+
+    void test_load_saved() {
+        std::string path = path_of("saved");
+        saved_snapshot(path);
+
+        unsigned long id = maptel_load(path.c_str());
+        assert(id != MAPTEL_LOAD_FAILED);
+        assert(transform(id, "123") == "789");
+        assert(transform(id, "111") == "222");
+        assert(transform(id, "995") == "885");
+        assert(transform(id, "5") == "5");
+        maptel_delete(id);
+    }
+
+    void test_load_corrupted() {
+        std::vector<char> good = saved_snapshot(path_of("saved"));
+        size_t entry = first_entry(good);
+
+        // Numer dłuższy niż TEL_NUM_MAX_LEN.
+        for (size_t key = 0; key < 3; ++key) {
+            std::vector<char> data = good;
+            data[entry + key * KEY_SIZE + LENGTH_OFFSET] =
+                    static_cast<char>(TEL_NUM_MAX_LEN + 1);
+            expect_load_failed(data);
+        }
+
+        // Zmiana na numer bez cyfr.
+        std::vector<char> data = good;
+        data[entry + KEY_SIZE + LENGTH_OFFSET] = 0;
+        expect_load_failed(data);
+
+        // Półbajt, który nie jest cyfrą.
+        data = good;
+        data[entry] = static_cast<char>(0xff);
+        expect_load_failed(data);
+
+        // Liczba zmian niezgodna z tablicą.
+        data = good;
+        data[COUNT_OFFSET] += 1;
+        expect_load_failed(data);
+
+        // Tablica bez pustej pozycji, na której szukanie by się zapętliło.
+        data = good;
+        for (size_t i = 0; i < capacity_of(data); ++i)
+            std::memcpy(data.data() + HEADER_SIZE + i * ENTRY_SIZE,
+                        good.data() + entry, ENTRY_SIZE);
+        expect_load_failed(data);
+
+        // Ucięty plik.
+        data = good;
+        data.resize(data.size() - 1);
+        expect_load_failed(data);
+        data.resize(HEADER_SIZE - 1);
+        expect_load_failed(data);
+
+        // Reguła prefiksu z numerem dłuższym niż TEL_NUM_MAX_LEN.
+        data = good;
+        data[data.size() - KEY_SIZE + LENGTH_OFFSET] =
+                static_cast<char>(TEL_NUM_MAX_LEN + 1);
+        expect_load_failed(data);
+    }
+
+    void test_journal_replay() {
+        std::string snapshot_path = path_of("journaled");
+        std::string journal_path = path_of("journal");
+        write_journal(snapshot_path, journal_path);
+
+        unsigned long id = open_journal(snapshot_path, journal_path);
+        expect_replayed(id, JOURNAL_RECORDS);
+        assert(read_file(journal_path).size() ==
+               JOURNAL_RECORDS * RECORD_SIZE);
+
+        // Migawka słownika ze zmianami ponad wczytaną migawką.
+        std::string saved_path = path_of("saved");
+        assert(maptel_save(id, saved_path.c_str()) == 0);
+        maptel_delete(id);
+
+        id = maptel_load(saved_path.c_str());
+        expect_replayed(id, JOURNAL_RECORDS);
+        maptel_delete(id);
+    }
+
+    void test_journal_short_tail() {
+        std::string snapshot_path = path_of("journaled");
+        std::string journal_path = path_of("journal");
+        write_journal(snapshot_path, journal_path);
+
+        // Wpis zapisany tylko częściowo przed przerwaniem procesu.
+        std::vector<char> data = read_file(journal_path);
+        data.insert(data.end(), data.begin(), data.begin() + RECORD_SIZE / 2);
+        write_file(journal_path, data);
+
+        unsigned long id = open_journal(snapshot_path, journal_path);
+        expect_replayed(id, JOURNAL_RECORDS);
+        assert(read_file(journal_path).size() ==
+               JOURNAL_RECORDS * RECORD_SIZE);
+
+        // Kolejne wpisy trafiają za ostatni poprawny.
+        maptel_insert(id, "6", "7");
+        assert(maptel_journal_sync(id) == 0);
+        maptel_delete(id);
+
+        id = open_journal(snapshot_path, journal_path);
+        assert(id != MAPTEL_LOAD_FAILED);
+        assert(transform(id, "123") == "1000");
+        assert(transform(id, "5") == "7");
+        maptel_delete(id);
+    }
+
+    void test_journal_bad_checksum() {
+        std::string snapshot_path = path_of("journaled");
+        std::string journal_path = path_of("journal");
+
+        // Uszkodzony ostatni wpis i wpis w środku dziennika.
+        for (size_t bad : {JOURNAL_RECORDS - 1, size_t(1)}) {
+            write_journal(snapshot_path, journal_path);
+            std::vector<char> data = read_file(journal_path);
+            data[bad * RECORD_SIZE + CHECKSUM_OFFSET] ^= 1;
+            write_file(journal_path, data);
+
+            unsigned long id = open_journal(snapshot_path, journal_path);
+            expect_replayed(id, bad);
+            assert(read_file(journal_path).size() == bad * RECORD_SIZE);
+            maptel_delete(id);
+        }
+    }
+
+    void test_compaction_crash() {
+        std::string snapshot_path = path_of("journaled");
+        std::string journal_path = path_of("journal");
+
+        // Przerwanie przed podmianą migawki: zostaje stara migawka,
+        // niedokończony plik tymczasowy i cały dziennik.
+        write_journal(snapshot_path, journal_path);
+        write_file(snapshot_path + ".tmp", std::vector<char>(100, 'x'));
+
+        unsigned long id = open_journal(snapshot_path, journal_path);
+        expect_replayed(id, JOURNAL_RECORDS);
+
+        // Przerwanie po podmianie migawki, a przed opróżnieniem dziennika:
+        // migawka zawiera już wszystkie zmiany z dziennika.
+        assert(maptel_save(id, snapshot_path.c_str()) == 0);
+        maptel_delete(id);
+        assert(read_file(journal_path).size() ==
+               JOURNAL_RECORDS * RECORD_SIZE);
+
+        id = open_journal(snapshot_path, journal_path);
+        expect_replayed(id, JOURNAL_RECORDS);
+        maptel_delete(id);
+    }
+}
+
+int main() {
+    char dir_template[] = "/tmp/maptel_test.XXXXXX";
+    if (mkdtemp(dir_template) == nullptr)
+        return 1;
+    dir = dir_template;
+
+    test_load_saved();
+    test_load_corrupted();
+    test_journal_replay();
+    test_journal_short_tail();
+    test_journal_bad_checksum();
+    test_compaction_crash();
+
+    std::string command = "rm -rf " + dir;
+    return std::system(command.c_str()) == 0 ? 0 : 1;
+}
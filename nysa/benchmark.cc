@@ -0,0 +1,452 @@
+/**
+ * @authors Olaf Placha, Michał Skwarek
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "circuit.h"
+
+using namespace std;
+using namespace nysa;
+
+/** Default number of valuated rows of each circuit. */
+const size_t DEFAULT_ROWS = 1 << 14;
+
+/** Number of rows formatted before the output buffer is cleared. */
+const size_t OUTPUT_CHUNK_ROWS = 16384;
+
+/** Maximal number of signals of a generated netlist. */
+const size_t MAX_GENERATED_SIGNALS = 1 << 26;
+
+/** Options given in command line. */
+struct Options {
+    /** Seed of random netlists. */
+    uint64_t seed = 1;
+    /** Maximal number of valuated rows of each circuit. */
+    size_t rows = DEFAULT_ROWS;
+    /** Whether netlists are simplified before valuation. */
+    bool optimize = true;
+    /** Family and size of the netlist printed instead of running benchmarks,
+     * empty if not given. */
+    string family;
+    size_t size = 0;
+};
+
+/**
+ * Netlist written gate by gate, with ids of signals given in order of
+ * creation starting from 1.
+ */
+class NetlistBuilder {
+public:
+    /**
+     * Creates input signals.
+     * @param count : number of input signals
+     * @return id of the first one, the others follow it
+     */
+    int32_t inputs(size_t count) {
+        int32_t first = nextId;
+        nextId += (int32_t)count;
+        return first;
+    }
+
+    /**
+     * Adds a gate valuating a new signal.
+     * @param gate : name of the gate
+     * @param operands : ids of signals read by the gate
+     * @return id of the new signal
+     */
+    int32_t gate(string_view gate, const vector<int32_t> &operands) {
+        int32_t id = nextId++;
+        string line(gate);
+        line += ' ' + to_string(id);
+        for (auto operand : operands)
+            line += ' ' + to_string(operand);
+        lines.push_back(move(line));
+        return id;
+    }
+
+    /**
+     * Shuffles order of the gates, which does not change the circuit.
+     * @param rng : source of randomness
+     */
+    void shuffle(mt19937_64 &rng) {
+        // rng() % n instead of distributions gives the same netlists with
+        // all standard libraries
+        for (size_t i = lines.size(); i > 1; --i)
+            swap(lines[i - 1], lines[rng() % i]);
+    }
+
+    /** Text of the netlist, one gate per line. */
+    string text() const {
+        string result;
+        for (auto const &line : lines)
+            result += line + '\n';
+        return result;
+    }
+
+private:
+    int32_t nextId = 1;
+    vector<string> lines;
+};
+
+/**
+ * Generates random acyclic netlist with 16 input signals. Each gate reads
+ * signals created before it, gates are given in random order.
+ * @param gates : number of gates
+ * @param seed : seed of the netlist
+ * @return netlist
+ */
+static string randomNetlist(size_t gates, uint64_t seed) {
+    static const string_view names[] = {"NOT", "XOR", "AND", "NAND", "OR",
+                                        "NOR"};
+    mt19937_64 rng(seed);
+    NetlistBuilder builder;
+    int32_t last = builder.inputs(16) + 15;
+
+    for (size_t i = 0; i < gates; ++i) {
+        string_view name = names[rng() % 6];
+        size_t count = name == "NOT" ? 1 : name == "XOR" ? 2 : 2 + rng() % 4;
+        vector<int32_t> operands;
+        for (size_t j = 0; j < count; ++j)
+            operands.push_back(1 + (int32_t)(rng() % (uint64_t)last));
+        last = builder.gate(name, operands);
+    }
+
+    builder.shuffle(rng);
+    return builder.text();
+}
+
+/**
+ * Generates ripple-carry adder of two numbers.
+ * @param bits : number of bits of each number
+ * @return netlist
+ */
+static string adderNetlist(size_t bits) {
+    NetlistBuilder builder;
+    int32_t a = builder.inputs(bits);
+    int32_t b = builder.inputs(bits);
+    int32_t carry = builder.gate("AND", {a, b});
+    builder.gate("XOR", {a, b});
+
+    for (int32_t i = 1; i < (int32_t)bits; ++i) {
+        int32_t half = builder.gate("XOR", {a + i, b + i});
+        builder.gate("XOR", {half, carry});
+        int32_t both = builder.gate("AND", {a + i, b + i});
+        int32_t propagated = builder.gate("AND", {half, carry});
+        carry = builder.gate("OR", {both, propagated});
+    }
+    return builder.text();
+}
+
+/**
+ * Generates multiplexer choosing one of 2^selects data signals, as a tree
+ * of two-way multiplexers.
+ * @param selects : number of selecting signals
+ * @return netlist
+ */
+static string multiplexerNetlist(size_t selects) {
+    NetlistBuilder builder;
+    size_t dataCount = (size_t)1 << selects;
+    int32_t data = builder.inputs(dataCount);
+    int32_t select = builder.inputs(selects);
+    vector<int32_t> level(dataCount);
+
+    for (size_t i = 0; i < dataCount; ++i)
+        level[i] = data + (int32_t)i;
+
+    for (size_t s = 0; s < selects; ++s) {
+        int32_t chooseFirst = builder.gate("NOT", {select + (int32_t)s});
+        vector<int32_t> next;
+        for (size_t i = 0; i < level.size(); i += 2) {
+            int32_t first = builder.gate("AND", {level[i], chooseFirst});
+            int32_t second = builder.gate("AND", {level[i + 1],
+                                                  select + (int32_t)s});
+            next.push_back(builder.gate("OR", {first, second}));
+        }
+        level = move(next);
+    }
+    return builder.text();
+}
+
+/**
+ * Generates AND, OR, NAND and NOR gates reading the same input signals.
+ * @param width : number of input signals
+ * @return netlist
+ */
+static string wideNetlist(size_t width) {
+    NetlistBuilder builder;
+    int32_t first = builder.inputs(width);
+    vector<int32_t> operands(width);
+
+    for (size_t i = 0; i < width; ++i)
+        operands[i] = first + (int32_t)i;
+
+    for (string_view name : {"AND", "OR", "NAND", "NOR"})
+        builder.gate(name, operands);
+    return builder.text();
+}
+
+/**
+ * Generates chain of NOT gates starting in a single input signal.
+ * @param depth : number of gates
+ * @return netlist
+ */
+static string chainNetlist(size_t depth) {
+    NetlistBuilder builder;
+    int32_t last = builder.inputs(1);
+
+    for (size_t i = 0; i < depth; ++i)
+        last = builder.gate("NOT", {last});
+    return builder.text();
+}
+
+/**
+ * Returns maximal size of netlists of the family, for which they have at most
+ * MAX_GENERATED_SIGNALS signals.
+ * @param family : random, adder, mux, wide or chain
+ * @return maximal size, 0 if the family does not exist
+ */
+static size_t maxNetlistSize(string_view family) {
+    if (family == "random")
+        return MAX_GENERATED_SIGNALS - 16;
+    if (family == "adder")
+        return MAX_GENERATED_SIGNALS / 7;
+    if (family == "mux") {
+        // 2^n + n inputs, n NOT gates and 3 * (2^n - 1) other gates
+        size_t selects = 0;
+        while (((size_t)4 << (selects + 1)) + 2 * (selects + 1)
+               <= MAX_GENERATED_SIGNALS)
+            ++selects;
+        return selects;
+    }
+    if (family == "wide")
+        return MAX_GENERATED_SIGNALS - 4;
+    if (family == "chain")
+        return MAX_GENERATED_SIGNALS - 1;
+    return 0;
+}
+
+/**
+ * Generates netlist of the family.
+ * @param family : random, adder, mux, wide or chain
+ * @param size : size of the netlist, its meaning depends on the family
+ * @param seed : seed of random netlists
+ * @param netlist : set to the netlist
+ * @return true if the family exists, otherwise false
+ */
+static bool generateNetlist(string_view family, size_t size, uint64_t seed,
+                            string &netlist) {
+    if (family == "random")
+        netlist = randomNetlist(size, seed);
+    else if (family == "adder")
+        netlist = adderNetlist(size);
+    else if (family == "mux")
+        netlist = multiplexerNetlist(size);
+    else if (family == "wide")
+        netlist = wideNetlist(size);
+    else if (family == "chain")
+        netlist = chainNetlist(size);
+    else
+        return false;
+    return true;
+}
+
+/** Times consecutive phases. */
+class Stopwatch {
+public:
+    Stopwatch() : last(chrono::steady_clock::now()) {}
+
+    /** Returns seconds elapsed since the previous call or construction. */
+    double lap() {
+        auto now = chrono::steady_clock::now();
+        double seconds = chrono::duration<double>(now - last).count();
+        last = now;
+        return seconds;
+    }
+
+private:
+    chrono::steady_clock::time_point last;
+};
+
+/**
+ * Runs all phases of printing the truth table on the netlist and prints
+ * their times as a single JSON object. Rows are formatted as text but not
+ * written anywhere.
+ * @param family : family of the netlist
+ * @param size : size of the netlist
+ * @param text : netlist
+ * @param options : options given in command line
+ * @return true if the netlist was correct, otherwise false
+ */
+static bool runBenchmark(string_view family, size_t size, string_view text,
+                         const Options &options) {
+    Stopwatch stopwatch;
+    graph g;
+    ostringstream errors;
+
+    if (!parseNetlist(text, g, errors)) {
+        cerr << errors.str();
+        return false;
+    }
+    double parseTime = stopwatch.lap();
+
+    if (hasCycle(g)) {
+        cerr << "Error: benchmarked circuit contains a cycle.\n";
+        return false;
+    }
+    double cycleTime = stopwatch.lap();
+
+    Netlist netlist = compileNetlist(g);
+    size_t gates = netlist.instructions.size();
+    if (options.optimize)
+        optimizeNetlist(netlist);
+    double compileTime = stopwatch.lap();
+
+    size_t n = netlist.inputs.size();
+    size_t rows = n >= WORD_BITS - 1 ? options.rows
+                                     : min(options.rows, (size_t)1 << n);
+    vector<word> values(netlist.signalIds.size() * BLOCK_WORDS);
+    string out;
+    double valuationTime = 0;
+    double outputTime = 0;
+
+    for (size_t first = 0; first < rows; first += BLOCK_ROWS) {
+        // input signals beyond the 64 last ones are 0 in all rows
+        for (size_t j = 0; j < n; ++j) {
+            size_t bit = n - 1 - j;
+            word *input = values.data() + netlist.inputs[j] * BLOCK_WORDS;
+            for (size_t k = 0; k < BLOCK_WORDS; ++k)
+                input[k] = bit < WORD_BITS
+                           ? inputSignalWord(bit, first + k * WORD_BITS) : 0;
+        }
+        valuateBlock(netlist, values.data());
+        valuationTime += stopwatch.lap();
+
+        // rows are formatted as in the text format of nysa
+        size_t count = min(BLOCK_ROWS, rows - first);
+        size_t width = netlist.columns.size() + 1;
+        size_t pos = out.size();
+        out.resize(pos + count * width);
+        for (size_t r = 0; r < count; ++r, pos += width) {
+            char *dst = out.data() + pos;
+            const word *words = values.data() + r / WORD_BITS;
+            for (size_t i = 0; i < width - 1; ++i)
+                dst[i] = (char)('0' + ((words[netlist.columns[i] * BLOCK_WORDS]
+                                        >> (r % WORD_BITS)) & 1));
+            dst[width - 1] = '\n';
+        }
+        if (out.size() >= OUTPUT_CHUNK_ROWS * width)
+            out.clear();
+        outputTime += stopwatch.lap();
+    }
+
+    size_t valuated = netlist.instructions.size();
+    // every block is valuated whole, even if only some of its rows are used
+    size_t blockRows = (rows + BLOCK_ROWS - 1) / BLOCK_ROWS * BLOCK_ROWS;
+    printf("{\"circuit\":\"%.*s\",\"size\":%zu,\"inputs\":%zu,\"gates\":%zu,"
+           "\"valuated_gates\":%zu,\"rows\":%zu,\"parse_s\":%.6f,"
+           "\"cycle_check_s\":%.6f,\"compile_s\":%.6f,\"valuation_s\":%.6f,"
+           "\"output_s\":%.6f,\"rows_per_s\":%.0f,\"gates_per_s\":%.0f}\n",
+           (int)family.size(), family.data(), size, n, gates, valuated,
+           rows, parseTime, cycleTime, compileTime, valuationTime, outputTime,
+           rows / (valuationTime + outputTime),
+           (double)blockRows * valuated / valuationTime);
+    fflush(stdout);
+    return true;
+}
+
+/**
+ * Parses command line arguments.
+ * @param argc : number of arguments
+ * @param argv : arguments
+ * @param options : options to fill
+ * @return true if arguments are correct, otherwise false
+ */
+static bool parseArguments(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+
+        if (arg == "--seed" && i + 1 < argc) {
+            string value = argv[++i];
+            size_t seed;
+            if (!parseNumber(value, seed)) {
+                cerr << "Error: invalid seed: " << value << "\n";
+                return false;
+            }
+            options.seed = seed;
+        } else if (arg == "--rows" && i + 1 < argc) {
+            string value = argv[++i];
+            if (!parseNumber(value, options.rows) || options.rows == 0) {
+                cerr << "Error: invalid number of rows: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--generate" && i + 2 < argc) {
+            options.family = argv[++i];
+            string value = argv[++i];
+            if (!parseNumber(value, options.size) || options.size == 0) {
+                cerr << "Error: invalid size: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--no-optimize") {
+            options.optimize = false;
+        } else {
+            cerr << "Error: invalid argument: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Benchmarks nysa on netlists of all families in growing sizes, printing
+ * one JSON object per netlist. With --generate FAMILY SIZE prints the
+ * netlist instead.
+ */
+int main(int argc, char *argv[]) {
+    static const pair<string_view, vector<size_t>> benchmarks[] = {
+            {"random", {1000, 10000, 100000}},
+            {"adder", {8, 32, 128}},
+            {"mux", {4, 8, 12}},
+            {"wide", {64, 1024, 16384}},
+            {"chain", {1000, 100000, 1000000}}
+    };
+    Options options;
+
+    if (!parseArguments(argc, argv, options))
+        return 1;
+
+    string netlist;
+
+    if (!options.family.empty()) {
+        size_t maxSize = maxNetlistSize(options.family);
+        if (maxSize == 0) {
+            cerr << "Error: invalid family: " << options.family << "\n";
+            return 1;
+        }
+        if (options.size > maxSize) {
+            cerr << "Error: size of " << options.family << " netlist "
+                 << options.size << " exceeds " << maxSize << ".\n";
+            return 1;
+        }
+        generateNetlist(options.family, options.size, options.seed, netlist);
+        fwrite(netlist.data(), 1, netlist.size(), stdout);
+        return 0;
+    }
+
+    for (auto const &[family, sizes] : benchmarks) {
+        for (auto size : sizes) {
+            generateNetlist(family, size, options.seed, netlist);
+            if (!runBenchmark(family, size, netlist, options))
+                return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,877 @@
+/**
+ * @authors Olaf Placha, Michał Skwarek
+ */
+
+#include "circuit.h"
+
+#include <algorithm>
+#include <numeric>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace nysa {
+
+/**
+ * Creates a gate depending on its name.
+ * @param gateName : name of the gate
+ * @return gate
+ */
+static Gate createGate(string_view gateName) {
+    if (gateName == "NOT")
+        return NOT;
+    else if (gateName == "XOR")
+        return XOR;
+    else if (gateName == "AND")
+        return AND;
+    else if (gateName == "NAND")
+        return NAND;
+    else if (gateName == "OR")
+        return OR;
+    else
+        return NOR;
+}
+
+/**
+ * Checks if number of input signals is suitable for given gate.
+ * @param gateName : name of the gate
+ * @param n : number of input signals
+ * @return true if number of signals is suitable, otherwise false
+ */
+static bool correctNumberOfSignals(Gate &gateName, size_t n) {
+    switch (gateName) {
+        case NOT:
+            return n == 1;
+        case XOR:
+            return n == 2;
+        default:
+            return n >= 2;
+    }
+}
+
+/**
+ * Checks if name of the gate is correct.
+ * @param gateName : name of the gate
+ * @return true if name is correct, otherwise false
+ */
+static bool correctGateName(string_view gateName) {
+    return gateName == "NOT" || gateName == "XOR" || gateName == "AND"
+           || gateName == "NAND" || gateName == "OR" || gateName == "NOR";
+}
+
+bool correctSignal(string_view sig, int32_t &curSig) {
+    if (sig.empty())
+        return false;
+
+    int64_t value = 0;
+    for (char c : sig) {
+        if (c < '0' || c > '9')
+            return false;
+        // larger values are incorrect anyway, stop before overflow
+        if (value <= 999999999)
+            value = value * 10 + (c - '0');
+    }
+    curSig = (int32_t)min<int64_t>(value, INT32_MAX);
+    return value >= 1 && value <= 999999999;
+}
+
+bool parseNumber(string_view text, size_t &value) {
+    if (text.empty() || text.size() > 19)
+        return false;
+
+    value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9')
+            return false;
+        value = value * 10 + (size_t)(c - '0');
+    }
+    return true;
+}
+
+/**
+ * Checks if character separates tokens in a line.
+ * @param c : character
+ * @return true if character is a whitespace, otherwise false
+ */
+static bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * Finds the next token in the line.
+ * @param line : line
+ * @param pos : position to start from, it is moved after the token
+ * @return token, empty if there are no more tokens
+ */
+static string_view nextToken(string_view line, size_t &pos) {
+    while (pos < line.size() && isSeparator(line[pos]))
+        ++pos;
+
+    size_t start = pos;
+    while (pos < line.size() && !isSeparator(line[pos]))
+        ++pos;
+
+    return line.substr(start, pos - start);
+}
+
+bool parseNetlist(string_view text, graph &g, ostream &errors,
+                  Counters *counters) {
+    size_t lineCount = 0;
+    uint64_t lookups = 0;
+    bool correctInput = true;
+    vector<int32_t> parents;
+
+    for (size_t lineStart = 0; lineStart < text.size();) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == string_view::npos)
+            lineEnd = text.size();
+
+        string_view line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        ++lineCount;
+
+        size_t pos = 0;
+        string_view gateName = nextToken(line, pos);
+
+        // check gate name
+        if (!correctGateName(gateName)) {
+            correctInput = false;
+            errors << "Error in line " << lineCount << ": " << line << "\n";
+            continue;
+        }
+
+        Gate curGate = createGate(gateName);
+        int32_t curOutSig;
+
+        // check if signal is a number in correct range
+        if (!correctSignal(nextToken(line, pos), curOutSig)) {
+            correctInput = false;
+            errors << "Error in line " << lineCount << ": " << line << "\n";
+            continue;
+        }
+
+        bool correctLine = true;
+        size_t count = 0;
+        parents.clear();
+
+        for (string_view inSig = nextToken(line, pos); !inSig.empty();
+             inSig = nextToken(line, pos)) {
+            int32_t curInSig;
+
+            if (!correctSignal(inSig, curInSig)) {
+                correctLine = false;
+                break;
+            }
+
+            parents.push_back(curInSig);
+            ++count;
+
+            // check if the number of input signals is correct
+            if ((curGate == NOT && count > 1) || (curGate == XOR && count > 2))
+                break;
+        }
+
+        if (!correctLine || !correctNumberOfSignals(curGate, count)) {
+            correctInput = false;
+            errors << "Error in line " << lineCount << ": " << line << "\n";
+            continue;
+        }
+
+        lookups += 2 + parents.size();
+        if (g.contains(curOutSig)) {
+            correctInput = false;
+            errors << "Error in line " << lineCount << ": "
+                   << "signal ";
+            errors << curOutSig << " is assigned to multiple outputs.\n";
+            continue;
+        }
+
+        g.insert(make_pair(curOutSig, make_pair(curGate,
+                unordered_set<int32_t>(parents.begin(), parents.end()))));
+    }
+
+    if (counters != nullptr)
+        counters->hashLookups += lookups;
+    return correctInput;
+}
+
+vector<vector<int32_t>> findCycles(const graph &g, Counters *counters) {
+    // only signals with gates can be a part of a cycle
+    vector<int32_t> ids;
+    ids.reserve(g.size());
+    for (auto const &pair : g)
+        ids.push_back(pair.first);
+    sort(ids.begin(), ids.end());
+
+    size_t n = ids.size();
+    unordered_map<int32_t, uint32_t> indexOf;
+    indexOf.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        indexOf.emplace(ids[i], (uint32_t)i);
+
+    // parents of every signal that have gates, in CSR form
+    vector<uint32_t> edgeStart(n + 1, 0);
+    vector<uint32_t> edges;
+    vector<char> selfLoop(n, false);
+    for (size_t i = 0; i < n; ++i) {
+        auto const &parents = g.at(ids[i]).second;
+        if (counters != nullptr)
+            counters->hashLookups += 2 + parents.size();
+        for (auto parent : parents) {
+            auto it = indexOf.find(parent);
+            if (it == indexOf.end())
+                continue;
+            edges.push_back(it->second);
+            selfLoop[i] = selfLoop[i] || it->second == i;
+        }
+        edgeStart[i + 1] = (uint32_t)edges.size();
+    }
+
+    // Tarjan's algorithm with an explicit stack of visited nodes and their
+    // next edges instead of recursion
+    const uint32_t UNVISITED = UINT32_MAX;
+    vector<uint32_t> order(n, UNVISITED);
+    vector<uint32_t> lowLink(n, 0);
+    vector<char> onStack(n, false);
+    vector<uint32_t> stack;
+    vector<pair<uint32_t, uint32_t>> calls;
+    uint32_t visited = 0;
+    vector<vector<int32_t>> cycles;
+
+    auto visit = [&](uint32_t v) {
+        order[v] = lowLink[v] = visited++;
+        stack.push_back(v);
+        onStack[v] = true;
+        calls.emplace_back(v, edgeStart[v]);
+    };
+
+    for (uint32_t root = 0; root < n; ++root) {
+        if (order[root] != UNVISITED)
+            continue;
+        visit(root);
+
+        while (!calls.empty()) {
+            auto &[v, edge] = calls.back();
+
+            if (edge < edgeStart[v + 1]) {
+                uint32_t w = edges[edge++];
+                if (order[w] == UNVISITED)
+                    visit(w);
+                else if (onStack[w])
+                    lowLink[v] = min(lowLink[v], order[w]);
+                continue;
+            }
+
+            uint32_t node = v;
+            calls.pop_back();
+            if (!calls.empty()) {
+                uint32_t caller = calls.back().first;
+                lowLink[caller] = min(lowLink[caller], lowLink[node]);
+            }
+            if (lowLink[node] != order[node])
+                continue;
+
+            // node is the root of a strongly connected component
+            vector<int32_t> component;
+            uint32_t w;
+            do {
+                w = stack.back();
+                stack.pop_back();
+                onStack[w] = false;
+                component.push_back(ids[w]);
+            } while (w != node);
+
+            if (component.size() > 1 || selfLoop[node]) {
+                sort(component.begin(), component.end());
+                cycles.push_back(move(component));
+            }
+        }
+    }
+
+    sort(cycles.begin(), cycles.end());
+    return cycles;
+}
+
+bool hasCycle(const graph &g, Counters *counters) {
+    return !findCycles(g, counters).empty();
+}
+
+graph extractCone(const graph &g, const vector<int32_t> &outputs,
+                  Counters *counters) {
+    graph cone;
+    uint64_t lookups = 0;
+    vector<int32_t> stack(outputs.begin(), outputs.end());
+
+    while (!stack.empty()) {
+        int32_t id = stack.back();
+        stack.pop_back();
+
+        auto it = g.find(id);
+        lookups += it == g.end() ? 1 : 3;
+        if (it == g.end() || cone.count(id) != 0)
+            continue;
+
+        cone.emplace(id, it->second);
+        for (auto parent : it->second.second)
+            stack.push_back(parent);
+    }
+
+    if (counters != nullptr)
+        counters->hashLookups += lookups;
+    return cone;
+}
+
+Netlist compileNetlist(const graph &g) {
+    Netlist netlist;
+    vector<int32_t> &ids = netlist.signalIds;
+
+    for (auto const &pair : g) {
+        ids.push_back(pair.first);
+        ids.insert(ids.end(), pair.second.second.begin(),
+                   pair.second.second.end());
+    }
+    sort(ids.begin(), ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+
+    auto indexOf = [&ids](int32_t id) {
+        return (uint32_t)(lower_bound(ids.begin(), ids.end(), id) - ids.begin());
+    };
+
+    // gate driving each signal, signals without one are input signals
+    size_t signalCount = ids.size();
+    vector<Instruction> driver(signalCount, Instruction{NOT, 0, 0, 0});
+    vector<char> isInput(signalCount, true);
+    vector<uint32_t> parents;
+
+    for (auto const &pair : g) {
+        uint32_t output = indexOf(pair.first);
+        driver[output] = Instruction{pair.second.first, output,
+                                     (uint32_t)parents.size(),
+                                     (uint32_t)pair.second.second.size()};
+        isInput[output] = false;
+
+        for (auto parent : pair.second.second)
+            parents.push_back(indexOf(parent));
+    }
+
+    // fan-out of every signal in CSR form, used for Kahn's algorithm
+    vector<uint32_t> fanOutStart(signalCount + 1, 0);
+    for (auto parent : parents)
+        ++fanOutStart[parent + 1];
+    for (size_t i = 0; i < signalCount; ++i)
+        fanOutStart[i + 1] += fanOutStart[i];
+
+    vector<uint32_t> fanOut(parents.size());
+    vector<uint32_t> fanOutEnd(fanOutStart.begin(), fanOutStart.end() - 1);
+    for (size_t i = 0; i < signalCount; ++i) {
+        if (isInput[i])
+            continue;
+        Instruction const &inst = driver[i];
+        for (uint32_t k = 0; k < inst.operandCount; ++k)
+            fanOut[fanOutEnd[parents[inst.firstOperand + k]]++] = (uint32_t)i;
+    }
+
+    vector<uint32_t> pendingParents(signalCount, 0);
+    vector<uint32_t> level(signalCount, 0);
+    vector<uint32_t> queue;
+    queue.reserve(signalCount);
+
+    for (size_t i = 0; i < signalCount; ++i) {
+        if (isInput[i]) {
+            netlist.inputs.push_back((uint32_t)i);
+            queue.push_back((uint32_t)i);
+        } else {
+            pendingParents[i] = driver[i].operandCount;
+        }
+    }
+
+    // signals are dequeued in topological order
+    for (size_t head = 0; head < queue.size(); ++head) {
+        uint32_t signal = queue[head];
+        for (uint32_t k = fanOutStart[signal]; k < fanOutStart[signal + 1]; ++k) {
+            uint32_t child = fanOut[k];
+            level[child] = max(level[child], level[signal] + 1);
+            if (--pendingParents[child] == 0)
+                queue.push_back(child);
+        }
+    }
+
+    vector<uint32_t> order(queue.begin() + (long)netlist.inputs.size(),
+                           queue.end());
+    stable_sort(order.begin(), order.end(), [&level](uint32_t a, uint32_t b) {
+        return level[a] < level[b];
+    });
+
+    for (size_t i = 0; i < signalCount; ++i) {
+        if (!isInput[i] && pendingParents[i] != 0)
+            order.push_back((uint32_t)i);
+    }
+
+    netlist.instructions.reserve(order.size());
+    netlist.operands.reserve(parents.size());
+    for (auto signal : order) {
+        Instruction inst = driver[signal];
+        uint32_t first = inst.firstOperand;
+        inst.firstOperand = (uint32_t)netlist.operands.size();
+        netlist.operands.insert(netlist.operands.end(),
+                                parents.begin() + first,
+                                parents.begin() + first + inst.operandCount);
+        netlist.instructions.push_back(inst);
+    }
+
+    netlist.columns.resize(signalCount);
+    iota(netlist.columns.begin(), netlist.columns.end(), 0);
+    return netlist;
+}
+
+namespace {
+
+/** Gate with its operands, identifies gates computing the same values. */
+struct GateKey {
+    Gate gate;
+    vector<uint32_t> operands;
+
+    bool operator==(const GateKey &that) const = default;
+};
+
+/** Hash of GateKey. */
+struct GateKeyHash {
+    size_t operator()(const GateKey &key) const {
+        size_t h = key.gate;
+        for (auto operand : key.operands)
+            h = h * 0x9E3779B97F4A7C15 + operand;
+        return h ^ (h >> 29);
+    }
+};
+
+} // namespace
+
+void optimizeNetlist(Netlist &netlist, Counters *counters) {
+    const uint32_t NONE = UINT32_MAX;
+    size_t signalCount = netlist.signalIds.size();
+    // signal valuated instead of each signal
+    vector<uint32_t> same(signalCount);
+    iota(same.begin(), same.end(), 0);
+    // value of signals known to be constant, -1 for others
+    vector<int8_t> constant(signalCount, -1);
+    // operand of NOT gates valuating each signal
+    vector<uint32_t> negationOf(signalCount, NONE);
+    uint32_t constantSignal[2] = {NONE, NONE};
+    unordered_map<GateKey, uint32_t, GateKeyHash> valuatedBy;
+    uint64_t lookups = 0;
+    vector<Instruction> instructions;
+    vector<uint32_t> operands;
+
+    for (auto const &inst : netlist.instructions) {
+        uint32_t output = inst.output;
+        GateKey key{inst.gate, {}};
+        for (uint32_t i = 0; i < inst.operandCount; ++i)
+            key.operands.push_back(
+                    same[netlist.operands[inst.firstOperand + i]]);
+
+        auto alias = [&](uint32_t signal) {
+            same[output] = signal;
+        };
+        auto emit = [&](GateKey &&gate) {
+            ++lookups;
+            auto it = valuatedBy.find(gate);
+            if (it != valuatedBy.end()) {
+                alias(it->second);
+                return;
+            }
+            if (gate.gate == NOT)
+                negationOf[output] = gate.operands[0];
+            instructions.push_back(Instruction{
+                    gate.gate, output, (uint32_t)operands.size(),
+                    (uint32_t)gate.operands.size()});
+            operands.insert(operands.end(), gate.operands.begin(),
+                            gate.operands.end());
+            ++lookups;
+            valuatedBy.emplace(move(gate), output);
+        };
+        auto makeConstant = [&](bool value) {
+            if (constantSignal[value] != NONE) {
+                alias(constantSignal[value]);
+                return;
+            }
+            constantSignal[value] = output;
+            constant[output] = value;
+            emit(GateKey{value ? AND : OR, {}});
+        };
+        auto negate = [&](uint32_t signal) {
+            if (constant[signal] != -1)
+                makeConstant(constant[signal] == 0);
+            else if (negationOf[signal] != NONE)
+                alias(negationOf[signal]);
+            else
+                emit(GateKey{NOT, {signal}});
+        };
+
+        vector<uint32_t> &ops = key.operands;
+        switch (inst.gate) {
+            case NOT:
+                negate(ops[0]);
+                break;
+            case XOR:
+                if (ops.size() == 1 || ops[0] == ops[1]) {
+                    makeConstant(false);
+                } else if (constant[ops[0]] != -1 && constant[ops[1]] != -1) {
+                    makeConstant(constant[ops[0]] != constant[ops[1]]);
+                } else if (constant[ops[0]] != -1 || constant[ops[1]] != -1) {
+                    bool first = constant[ops[0]] != -1;
+                    uint32_t other = first ? ops[1] : ops[0];
+                    if (constant[first ? ops[0] : ops[1]] == 0)
+                        alias(other);
+                    else
+                        negate(other);
+                } else {
+                    sort(ops.begin(), ops.end());
+                    emit(move(key));
+                }
+                break;
+            default: {
+                // AND and NAND are folded like OR and NOR with inverted values
+                bool isAnd = inst.gate == AND || inst.gate == NAND;
+                bool negated = inst.gate == NAND || inst.gate == NOR;
+                int8_t dominant = isAnd ? 0 : 1;
+
+                if (any_of(ops.begin(), ops.end(), [&](uint32_t signal) {
+                        return constant[signal] == dominant;
+                    })) {
+                    makeConstant((dominant != 0) != negated);
+                    break;
+                }
+                erase_if(ops, [&](uint32_t signal) {
+                    return constant[signal] != -1;
+                });
+                sort(ops.begin(), ops.end());
+                ops.erase(unique(ops.begin(), ops.end()), ops.end());
+
+                if (ops.empty())
+                    makeConstant((dominant == 0) != negated);
+                else if (ops.size() == 1 && negated)
+                    negate(ops[0]);
+                else if (ops.size() == 1)
+                    alias(ops[0]);
+                else
+                    emit(move(key));
+            }
+        }
+    }
+
+    for (auto &column : netlist.columns)
+        column = same[column];
+
+    // remove gates whose values are not needed, in reverse topological order
+    vector<char> needed(signalCount, false);
+    for (auto column : netlist.columns)
+        needed[column] = true;
+
+    vector<Instruction> neededInstructions;
+    for (auto it = instructions.rbegin(); it != instructions.rend(); ++it) {
+        if (!needed[it->output])
+            continue;
+        for (uint32_t i = 0; i < it->operandCount; ++i)
+            needed[operands[it->firstOperand + i]] = true;
+        neededInstructions.push_back(*it);
+    }
+    reverse(neededInstructions.begin(), neededInstructions.end());
+
+    netlist.instructions.clear();
+    netlist.operands.clear();
+    for (auto inst : neededInstructions) {
+        uint32_t first = inst.firstOperand;
+        inst.firstOperand = (uint32_t)netlist.operands.size();
+        netlist.operands.insert(netlist.operands.end(),
+                                operands.begin() + first,
+                                operands.begin() + first + inst.operandCount);
+        netlist.instructions.push_back(inst);
+    }
+
+    if (counters != nullptr)
+        counters->hashLookups += lookups;
+}
+
+word inputSignalWord(size_t bit, size_t firstRow) {
+    // patterns of the lowest bits of row numbers 0, 1, ..., 63
+    static const word lowBitPatterns[] = {
+            0xAAAAAAAAAAAAAAAA, 0xCCCCCCCCCCCCCCCC, 0xF0F0F0F0F0F0F0F0,
+            0xFF00FF00FF00FF00, 0xFFFF0000FFFF0000, 0xFFFFFFFF00000000
+    };
+
+    if (bit < 6)
+        return lowBitPatterns[bit];
+    return ((firstRow >> bit) & 1) != 0 ? ~word(0) : word(0);
+}
+
+void valuateInstructions(const Netlist &netlist, vector<word> &values) {
+    if (netlist.kernel != nullptr) {
+        netlist.kernel(values.data());
+        return;
+    }
+
+    for (auto const &inst : netlist.instructions)
+        values[inst.output] = valuateSignalBasedOnParentsAndGate(
+                inst, netlist.operands, values);
+}
+
+void populateValuation(const Netlist &netlist, vector<word> &values,
+                       size_t firstRow) {
+    size_t n = netlist.inputs.size();
+
+    // giving following binary numbers to sorted input signals
+    for (size_t j = 0; j < n; ++j)
+        values[netlist.inputs[j]] = inputSignalWord(n - 1 - j, firstRow);
+
+    valuateInstructions(netlist, values);
+}
+
+namespace {
+
+/** Function valuating instructions of a netlist in a block of rows. */
+using BlockValuation = void (*)(const Netlist &, word *);
+
+/** Valuates a block of rows word by word. */
+void valuateBlockScalar(const Netlist &netlist, word *values) {
+    for (auto const &inst : netlist.instructions) {
+        const uint32_t *parents = netlist.operands.data() + inst.firstOperand;
+        word *output = values + inst.output * BLOCK_WORDS;
+
+        for (size_t k = 0; k < BLOCK_WORDS; ++k) {
+            word result;
+            switch (inst.gate) {
+                case NOT:
+                    result = ~values[parents[0] * BLOCK_WORDS + k];
+                    break;
+                case XOR:
+                    // gate with 2 identical input streams is 0
+                    result = inst.operandCount == 1
+                             ? 0 : values[parents[0] * BLOCK_WORDS + k]
+                                   ^ values[parents[1] * BLOCK_WORDS + k];
+                    break;
+                case AND:
+                case NAND:
+                    result = ~word(0);
+                    for (uint32_t i = 0; i < inst.operandCount; ++i)
+                        result &= values[parents[i] * BLOCK_WORDS + k];
+                    result = inst.gate == NAND ? ~result : result;
+                    break;
+                default:
+                    result = 0;
+                    for (uint32_t i = 0; i < inst.operandCount; ++i)
+                        result |= values[parents[i] * BLOCK_WORDS + k];
+                    result = inst.gate == NOR ? ~result : result;
+                    break;
+            }
+            output[k] = result;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/** Valuates a block of rows two words at a time. */
+__attribute__((target("sse2")))
+void valuateBlockSSE2(const Netlist &netlist, word *values) {
+    static_assert(BLOCK_WORDS % 2 == 0);
+    auto block = reinterpret_cast<__m128i *>(values);
+    const size_t vectors = BLOCK_WORDS / 2;
+    const __m128i ones = _mm_set1_epi64x(-1);
+
+    for (auto const &inst : netlist.instructions) {
+        const uint32_t *parents = netlist.operands.data() + inst.firstOperand;
+        __m128i *output = block + inst.output * vectors;
+
+        for (size_t k = 0; k < vectors; ++k) {
+            __m128i result;
+            switch (inst.gate) {
+                case NOT:
+                    result = _mm_xor_si128(
+                            _mm_loadu_si128(block + parents[0] * vectors + k),
+                            ones);
+                    break;
+                case XOR:
+                    // gate with 2 identical input streams is 0
+                    result = inst.operandCount == 1
+                             ? _mm_setzero_si128()
+                             : _mm_xor_si128(
+                                    _mm_loadu_si128(
+                                            block + parents[0] * vectors + k),
+                                    _mm_loadu_si128(
+                                            block + parents[1] * vectors + k));
+                    break;
+                case AND:
+                case NAND:
+                    result = ones;
+                    for (uint32_t i = 0; i < inst.operandCount; ++i)
+                        result = _mm_and_si128(
+                                result, _mm_loadu_si128(
+                                        block + parents[i] * vectors + k));
+                    if (inst.gate == NAND)
+                        result = _mm_xor_si128(result, ones);
+                    break;
+                default:
+                    result = _mm_setzero_si128();
+                    for (uint32_t i = 0; i < inst.operandCount; ++i)
+                        result = _mm_or_si128(
+                                result, _mm_loadu_si128(
+                                        block + parents[i] * vectors + k));
+                    if (inst.gate == NOR)
+                        result = _mm_xor_si128(result, ones);
+                    break;
+            }
+            _mm_storeu_si128(output + k, result);
+        }
+    }
+}
+
+/** Valuates a block of rows four words at a time. */
+__attribute__((target("avx2")))
+void valuateBlockAVX2(const Netlist &netlist, word *values) {
+    static_assert(BLOCK_WORDS == 4);
+    auto block = reinterpret_cast<__m256i *>(values);
+    const __m256i ones = _mm256_set1_epi64x(-1);
+
+    for (auto const &inst : netlist.instructions) {
+        const uint32_t *parents = netlist.operands.data() + inst.firstOperand;
+        __m256i result;
+
+        switch (inst.gate) {
+            case NOT:
+                result = _mm256_xor_si256(
+                        _mm256_loadu_si256(block + parents[0]), ones);
+                break;
+            case XOR:
+                // gate with 2 identical input streams is 0
+                result = inst.operandCount == 1
+                         ? _mm256_setzero_si256()
+                         : _mm256_xor_si256(
+                                _mm256_loadu_si256(block + parents[0]),
+                                _mm256_loadu_si256(block + parents[1]));
+                break;
+            case AND:
+            case NAND:
+                result = ones;
+                for (uint32_t i = 0; i < inst.operandCount; ++i)
+                    result = _mm256_and_si256(
+                            result, _mm256_loadu_si256(block + parents[i]));
+                if (inst.gate == NAND)
+                    result = _mm256_xor_si256(result, ones);
+                break;
+            default:
+                result = _mm256_setzero_si256();
+                for (uint32_t i = 0; i < inst.operandCount; ++i)
+                    result = _mm256_or_si256(
+                            result, _mm256_loadu_si256(block + parents[i]));
+                if (inst.gate == NOR)
+                    result = _mm256_xor_si256(result, ones);
+                break;
+        }
+        _mm256_storeu_si256(block + inst.output, result);
+    }
+}
+
+#endif
+
+/** Chooses the block valuation for the processor the program runs on. */
+BlockValuation selectBlockValuation() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return valuateBlockAVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return valuateBlockSSE2;
+#endif
+    return valuateBlockScalar;
+}
+
+} // namespace
+
+void valuateBlock(const Netlist &netlist, word *values) {
+    static const BlockValuation valuation = selectBlockValuation();
+    valuation(netlist, values);
+}
+
+void populateBlock(const Netlist &netlist, vector<word> &values,
+                   size_t firstRow) {
+    size_t n = netlist.inputs.size();
+
+    for (size_t j = 0; j < n; ++j) {
+        word *input = values.data() + netlist.inputs[j] * BLOCK_WORDS;
+        for (size_t k = 0; k < BLOCK_WORDS; ++k)
+            input[k] = inputSignalWord(n - 1 - j, firstRow + k * WORD_BITS);
+    }
+
+    valuateBlock(netlist, values.data());
+}
+
+Circuit::Circuit(const graph &g, bool optimize) {
+    if (hasCycle(g))
+        throw invalid_argument("circuit contains a cycle");
+
+    compiled = compileNetlist(g);
+    if (optimize)
+        optimizeNetlist(compiled);
+}
+
+optional<Circuit> Circuit::parse(string_view text, ostream &errors,
+                                 bool optimize) {
+    graph g;
+
+    if (!parseNetlist(text, g, errors))
+        return nullopt;
+
+    if (hasCycle(g)) {
+        errors << "Error: circuit contains a cycle.\n";
+        return nullopt;
+    }
+    return Circuit(g, optimize);
+}
+
+void Circuit::valuate(const word *inputs, word *values,
+                      vector<word> &scratch) const {
+    scratch.resize(compiled.signalIds.size());
+
+    for (size_t j = 0; j < compiled.inputs.size(); ++j)
+        scratch[compiled.inputs[j]] = inputs[j];
+
+    valuateInstructions(compiled, scratch);
+
+    for (size_t i = 0; i < compiled.columns.size(); ++i)
+        values[i] = scratch[compiled.columns[i]];
+}
+
+vector<bool> Circuit::valuate(const vector<bool> &inputs) const {
+    size_t n = inputCount();
+    size_t m = signalCount();
+    size_t vectors = n == 0 ? 0 : inputs.size() / n;
+    vector<bool> result(vectors * m);
+    vector<word> inputWords(n);
+    vector<word> valueWords(m);
+    vector<word> scratch;
+
+    for (size_t first = 0; first < vectors; first += WORD_BITS) {
+        size_t count = min(WORD_BITS, vectors - first);
+
+        fill(inputWords.begin(), inputWords.end(), 0);
+        for (size_t r = 0; r < count; ++r) {
+            for (size_t j = 0; j < n; ++j) {
+                if (inputs[(first + r) * n + j])
+                    inputWords[j] |= word(1) << r;
+            }
+        }
+
+        valuate(inputWords.data(), valueWords.data(), scratch);
+
+        for (size_t r = 0; r < count; ++r) {
+            for (size_t i = 0; i < m; ++i)
+                result[(first + r) * m + i] = ((valueWords[i] >> r) & 1) != 0;
+        }
+    }
+    return result;
+}
+
+} // namespace nysa
@@ -0,0 +1,364 @@
+/**
+ * @authors Olaf Placha, Michał Skwarek
+ */
+
+#ifndef __CIRCUIT_H
+#define __CIRCUIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace nysa {
+
+/** Holds all possible gate types. */
+enum Gate { NOT, XOR, AND, NAND, OR, NOR };
+
+/** Child to gate type and set of parents mapping. */
+using graph = std::unordered_map<int32_t,
+        std::pair<Gate, std::unordered_set<int32_t>>>;
+
+/** Work done by functions of the library that are given it. */
+struct Counters {
+    /** Number of lookups and insertions in hash tables. */
+    uint64_t hashLookups = 0;
+};
+
+/** Values of a signal in consecutive rows of the truth table, one per bit. */
+using word = uint64_t;
+
+/** Number of rows valuated at once. */
+constexpr size_t WORD_BITS = 64;
+
+/** Number of words holding values of a signal in a block of rows. */
+constexpr size_t BLOCK_WORDS = 4;
+
+/** Number of rows of a block, valuated at once by valuateBlock. */
+constexpr size_t BLOCK_ROWS = BLOCK_WORDS * WORD_BITS;
+
+/** Valuates all instructions of a netlist, values are indexed as in it. */
+using Kernel = void (*)(word *values);
+
+/** Gate of compiled netlist, its operands are stored separately. */
+struct Instruction {
+    Gate gate;
+    /** Index of the output signal. */
+    uint32_t output;
+    /** Position of the first operand in operands array. */
+    uint32_t firstOperand;
+    uint32_t operandCount;
+};
+
+/**
+ * Circuit compiled for evaluation. Signals are identified by their indices
+ * in signalIds, instructions are sorted topologically and each of them reads
+ * its operands from a contiguous range of operands array.
+ */
+struct Netlist {
+    /** Ids of all signals in ascending order. */
+    std::vector<int32_t> signalIds;
+    /** Indices of input signals in ascending order. */
+    std::vector<uint32_t> inputs;
+    std::vector<Instruction> instructions;
+    std::vector<uint32_t> operands;
+    /** Indices of signals holding values of printed signals, in order of
+     * printing. Signals that are equivalent to others are not valuated. */
+    std::vector<uint32_t> columns;
+    /** Native code valuating all instructions, if the netlist was compiled. */
+    Kernel kernel = nullptr;
+};
+
+/**
+ * Parses netlist, every line describes a single gate: its name, output
+ * signal and input signals. Incorrect lines are reported on errors stream.
+ * @param text : netlist
+ * @param g : graph to fill with correct lines
+ * @param errors : stream for errors
+ * @param counters : counters of work, if given
+ * @return true if all lines are correct, otherwise false
+ */
+bool parseNetlist(std::string_view text, graph &g, std::ostream &errors,
+                  Counters *counters = nullptr);
+
+/**
+ * Checks if signal is correct. If it is, set its value on given variable.
+ * @param sig : signal
+ * @param curSig : signal value
+ * @return true if signal is valid, otherwise false
+ */
+bool correctSignal(std::string_view sig, int32_t &curSig);
+
+/**
+ * Parses a non-negative decimal number.
+ * @param text : text of the number
+ * @param value : set to the parsed number
+ * @return true if text is a number that fits in size_t, otherwise false
+ */
+bool parseNumber(std::string_view text, size_t &value);
+
+/**
+ * Finds strongly connected components of the graph that contain a cycle,
+ * in linear time and without recursion.
+ * @param g : graph
+ * @param counters : counters of work, if given
+ * @return ids of signals of every component in ascending order, components
+ * are sorted by their smallest ids
+ */
+std::vector<std::vector<int32_t>> findCycles(const graph &g,
+                                             Counters *counters = nullptr);
+
+/**
+ * Detects cycle in a graph
+ * @param g : graph
+ * @param counters : counters of work, if given
+ * @return true iff given graph contains cycle
+ */
+bool hasCycle(const graph &g, Counters *counters = nullptr);
+
+/**
+ * Extracts transitive fan-in cone of given signals, i.e. gates whose values
+ * are needed to valuate them. Input signals of the cone are the input
+ * signals these gates read.
+ * @param g : graph
+ * @param outputs : ids of signals valuated by gates of the graph
+ * @param counters : counters of work, if given
+ * @return graph with gates of the cone
+ */
+graph extractCone(const graph &g, const std::vector<int32_t> &outputs,
+                  Counters *counters = nullptr);
+
+/**
+ * Compiles graph into netlist. Signal ids are replaced with their positions
+ * in ascending order of ids and gates are sorted by their levels, i.e. by
+ * length of the longest path from an input signal. Gates that are part of a
+ * cycle or depend on one are placed after all others in ascending order of
+ * ids, so instructions are sorted topologically only for acyclic graphs.
+ * @param g : graph
+ * @return netlist
+ */
+Netlist compileNetlist(const graph &g);
+
+/**
+ * Simplifies acyclic netlist without changing values of printed signals.
+ * Gates with constant or duplicated operands are folded, double negations
+ * are removed and gates computing the same function of the same signals are
+ * merged. Printed signals equal to other signals or constants take values
+ * from them, and gates whose values are not needed anymore are removed.
+ * Constants are valuated by gates without operands: AND (1) and OR (0).
+ * @param netlist : netlist with instructions sorted topologically
+ * @param counters : counters of work, if given
+ */
+void optimizeNetlist(Netlist &netlist, Counters *counters = nullptr);
+
+/**
+ * Returns word holding values of the input signal for 64 consecutive rows.
+ * Bit r of the word is the value of the signal in row firstRow + r.
+ * @param bit : position of the signal's bit in binary row number
+ * @param firstRow : number of the first row, divisible by WORD_BITS
+ * @return word with values of the input signal
+ */
+word inputSignalWord(size_t bit, size_t firstRow);
+
+/**
+ * Returns XOR of values of given signals
+ * @param values : values of all signals
+ * @param signals : indices of signals
+ * @param count : number of signals
+ * @return word, result of XOR
+ */
+inline word gateXOR(const std::vector<word> &values, const uint32_t *signals,
+                    size_t count) {
+    if (count == 1) {
+        // gate must have 2 identical input streams
+        return 0;
+    }
+    return values[signals[0]] ^ values[signals[1]];
+}
+
+/**
+ * Returns AND of values of given signals
+ * @param values : values of all signals
+ * @param signals : indices of signals
+ * @param count : number of signals
+ * @return word, result of AND
+ */
+inline word gateAND(const std::vector<word> &values, const uint32_t *signals,
+                    size_t count) {
+    word result = ~word(0);
+
+    for (size_t i = 0; i < count; ++i) {
+        result &= values[signals[i]];
+    }
+    return result;
+}
+
+/**
+ * Returns OR of values of given signals
+ * @param values : values of all signals
+ * @param signals : indices of signals
+ * @param count : number of signals
+ * @return word, result of OR
+ */
+inline word gateOR(const std::vector<word> &values, const uint32_t *signals,
+                   size_t count) {
+    word result = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        result |= values[signals[i]];
+    }
+    return result;
+}
+
+/**
+ * Returns output signal of given instruction
+ * @param inst : instruction
+ * @param operands : operands of all instructions
+ * @param values : values of all signals
+ * @return output signal's value
+ */
+inline word
+valuateSignalBasedOnParentsAndGate(const Instruction &inst,
+                                   const std::vector<uint32_t> &operands,
+                                   const std::vector<word> &values) {
+    const uint32_t *parents = operands.data() + inst.firstOperand;
+
+    switch (inst.gate) {
+        case NOT:
+            return ~values[parents[0]];
+        case XOR:
+            return gateXOR(values, parents, inst.operandCount);
+        case AND:
+            return gateAND(values, parents, inst.operandCount);
+        case NAND:
+            return ~gateAND(values, parents, inst.operandCount);
+        case OR:
+            return gateOR(values, parents, inst.operandCount);
+        case NOR:
+            return ~gateOR(values, parents, inst.operandCount);
+        default:
+            throw std::invalid_argument("invalid gate type!");
+    }
+}
+
+/**
+ * Valuates all instructions of the netlist, values of input signals have to
+ * be set before.
+ * @param netlist : netlist with instructions sorted topologically
+ * @param values : values of all signals, indexed as in netlist
+ */
+void valuateInstructions(const Netlist &netlist, std::vector<word> &values);
+
+/**
+ * Valuates all signals of the netlist in a block of WORD_BITS rows.
+ * @param netlist : netlist
+ * @param values : values of all signals, indexed as in netlist
+ * @param firstRow : number of the first row in the block
+ */
+void populateValuation(const Netlist &netlist, std::vector<word> &values,
+                       size_t firstRow);
+
+/**
+ * Valuates all instructions of the netlist in a block of BLOCK_ROWS rows.
+ * Words of a signal are adjacent, so every operand is read with one vector
+ * load and the cost per operand does not depend on the width of gates.
+ * Uses the widest vector instructions the processor supports, chosen at
+ * the first call. Values of input signals have to be set before.
+ * @param netlist : netlist with instructions sorted topologically
+ * @param values : values of all signals, word k of signal i is at index
+ * i * BLOCK_WORDS + k and holds rows from k * WORD_BITS of the block
+ */
+void valuateBlock(const Netlist &netlist, word *values);
+
+/**
+ * Valuates all signals of the netlist in a block of BLOCK_ROWS rows.
+ * @param netlist : netlist
+ * @param values : values of all signals, indexed as in valuateBlock
+ * @param firstRow : number of the first row in the block, divisible by
+ * BLOCK_ROWS
+ */
+void populateBlock(const Netlist &netlist, std::vector<word> &values,
+                   size_t firstRow);
+
+/**
+ * Acyclic circuit prepared for valuation of many vectors of input values.
+ * Vectors are valuated in batches of WORD_BITS, one per bit of a word.
+ */
+class Circuit {
+public:
+    /**
+     * Compiles the graph.
+     * @param g : acyclic graph
+     * @param optimize : whether the netlist is simplified
+     * @throws std::invalid_argument if the graph contains a cycle
+     */
+    explicit Circuit(const graph &g, bool optimize = true);
+
+    /**
+     * Parses and compiles the netlist.
+     * @param text : netlist
+     * @param errors : stream for errors
+     * @param optimize : whether the netlist is simplified
+     * @return circuit, or nothing if the netlist is incorrect or cyclic
+     */
+    static std::optional<Circuit> parse(std::string_view text,
+                                        std::ostream &errors,
+                                        bool optimize = true);
+
+    /** Number of input signals. */
+    size_t inputCount() const {
+        return compiled.inputs.size();
+    }
+
+    /** Number of all signals, including input ones. */
+    size_t signalCount() const {
+        return compiled.signalIds.size();
+    }
+
+    /** Ids of all signals in ascending order. */
+    const std::vector<int32_t> &signalIds() const {
+        return compiled.signalIds;
+    }
+
+    const Netlist &netlist() const {
+        return compiled;
+    }
+
+    /** Makes valuation run given native code valuating the netlist. */
+    void useKernel(Kernel kernel) {
+        compiled.kernel = kernel;
+    }
+
+    /**
+     * Valuates up to WORD_BITS vectors at once.
+     * @param inputs : values of input signals in ascending order of ids,
+     * bit r of each word belongs to r-th vector
+     * @param values : filled with values of all signals in ascending order of
+     * ids, bit r of each word belongs to r-th vector
+     * @param scratch : buffer reused between calls
+     */
+    void valuate(const word *inputs, word *values,
+                 std::vector<word> &scratch) const;
+
+    /**
+     * Valuates vectors of input values.
+     * @param inputs : values of input signals of consecutive vectors, each
+     * vector holds inputCount() values in ascending order of ids
+     * @return values of all signals of consecutive vectors, each vector
+     * holds signalCount() values in ascending order of ids
+     */
+    std::vector<bool> valuate(const std::vector<bool> &inputs) const;
+
+private:
+    Netlist compiled;
+};
+
+} // namespace nysa
+
+#endif // __CIRCUIT_H
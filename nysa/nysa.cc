@@ -2,439 +2,2123 @@
  * @authors Olaf Placha, Michał Skwarek
  */
 
-#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <iomanip>
 #include <iostream>
-#include <regex>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "circuit.h"
 
 using namespace std;
+using namespace nysa;
 
-/** Holds all possible gate types. */
-enum Gate { NOT, XOR, AND, NAND, OR, NOR };
-
-/** Child to gate type and set of parents mapping. */
-using graph = unordered_map<int32_t, pair<Gate, unordered_set<int32_t>>>;
-
-/**
- * Creates a gate depending on its name.
- * @param gateName : name of the gate
- * @return gate
- */
-static Gate createGate(string &gateName) {
-    if (gateName == "NOT")
-        return NOT;
-    else if (gateName == "XOR")
-        return XOR;
-    else if (gateName == "AND")
-        return AND;
-    else if (gateName == "NAND")
-        return NAND;
-    else if (gateName == "OR")
-        return OR;
-    else
-        return NOR;
-}
+/** Maximal number of input signals, so that rows can be numbered. */
+const size_t MAX_INPUT_SIGNALS = 63;
+
+/** Maximal number of worker threads. */
+const size_t MAX_THREADS = 1024;
+
+/** Number of rows formatted at once by a single thread. */
+const size_t CHUNK_ROWS = 1 << 14;
+
+/** Number of rows of a block enumerated in Gray code order. */
+const size_t GRAY_BLOCK_ROWS = 1 << 12;
+
+/** Holds all strategies of truth table valuation. */
+enum Engine {
+    /** Valuates all signals for WORD_BITS rows at once. */
+    BITSLICE,
+    /** Valuates rows in Gray code order, only fan-out cone of the changed
+     * input signal is valuated again. */
+    GRAY
+};
+
+/** Holds all formats of printed rows. */
+enum OutputFormat {
+    /** Every row is a line of '0' and '1' characters. */
+    TEXT,
+    /** Values of consecutive signals are packed into bits of consecutive
+     * bytes, starting from the most significant bit. Every row starts in a
+     * new byte and there are no separators. */
+    BINARY
+};
+
+/** Options given in command line. */
+struct Options {
+    /** Number of threads valuating rows. */
+    size_t threads = 1;
+    Engine engine = BITSLICE;
+    OutputFormat format = TEXT;
+    /** Whether netlist is simplified before valuation. */
+    bool optimize = true;
+    /** Whether the bit-sliced engine runs netlist compiled to native code. */
+    bool compile = false;
+    /** Whether stuck-at faults are simulated instead of printing the truth
+     * table. */
+    bool faults = false;
+    /** Ids of signals whose fan-in cones are valuated, the other gates and
+     * input signals are ignored. Empty if the whole circuit is valuated. */
+    vector<int32_t> outputs;
+    /** Whether statistics of the run are reported on the standard error,
+     * and whether as JSON. */
+    bool stats = false;
+    bool statsJson = false;
+    /** Whether feedback loops are printed instead of the truth table. */
+    bool cycles = false;
+    /** Path of the netlist, "-" for the standard input. */
+    string circuitPath = "-";
+    /** Path of vectors of input values to valuate instead of printing the
+     * truth table, "-" for the standard input, empty if not given. */
+    string vectorsPath;
+    /** Whether the circuit is analyzed with binary decision diagrams. */
+    bool symbolic = false;
+    /** Whether equivalence of a pair of signals is checked. */
+    bool equivalentGiven = false;
+    pair<int32_t, int32_t> equivalent;
+    /** Whether only rows from firstRow to lastRow (exclusive) are printed. */
+    bool rowsGiven = false;
+    size_t firstRow = 0;
+    size_t lastRow = 0;
+    /** Rows are split into shardCount parts and only part number shard
+     * (counting from 0) is printed, if shardCount is not 0. */
+    size_t shard = 0;
+    size_t shardCount = 0;
+};
+
+/** Number of instructions of a single function of generated native code. */
+const size_t KERNEL_PART_INSTRUCTIONS = 4096;
+
+/** Number of entries of the cache of operations on decision diagrams. */
+const size_t BDD_CACHE_SIZE = 1 << 20;
+
+/** Maximal number of nodes of decision diagrams. */
+const size_t MAX_BDD_NODES = 1 << 27;
+
+/** Number of faults simulated at once, lane 0 is left for the circuit
+ * without faults. */
+const size_t FAULTS_PER_GROUP = WORD_BITS - 1;
+
+/** Faults of a single signal injected in lanes of its value. */
+struct FaultInjection {
+    /** Number of instructions valuated before the signal is known. */
+    uint32_t position;
+    uint32_t signal;
+    /** Lanes in which the signal is stuck at 0 and at 1. */
+    word stuckAt0;
+    word stuckAt1;
+};
+
+/** Faults simulated at once. */
+struct FaultGroup {
+    /** Number of the first fault of the group. */
+    size_t firstFault;
+    size_t faultCount;
+    /** Injections sorted by positions. */
+    vector<FaultInjection> injections;
+};
 
 /**
- * Checks if number of input signals is suitable for given gate.
- * @param gateName : name of the gate
- * @param n : number of input signals
- * @return true if number of signals is suitable, otherwise false
+ * Counters and timers of the run, reported with --stats. Hot paths update
+ * them at most once per block of rows and only if statistics are enabled,
+ * so they cost nothing otherwise. Thread times are summed over threads.
  */
-static bool correctNumberOfSignals(Gate &gateName, size_t n) {
-    switch (gateName) {
-        case NOT:
-            return n == 1;
-        case XOR:
-            return n == 2;
-        default:
-            return n >= 2;
+class Statistics {
+public:
+    atomic<uint64_t> gatesValuated = 0;
+    atomic<uint64_t> rows = 0;
+    atomic<uint64_t> bytesWritten = 0;
+    /** Counters of the library and of decision diagrams, updated by the
+     * main thread. */
+    Counters counters;
+    atomic<uint64_t> valuationNanos = 0;
+    atomic<uint64_t> formattingNanos = 0;
+    atomic<uint64_t> writingNanos = 0;
+
+    void enable() {
+        isEnabled = true;
+    }
+
+    bool enabled() const {
+        return isEnabled;
+    }
+
+    /** Counters given to the library, nullptr if statistics are disabled. */
+    Counters *libraryCounters() {
+        return isEnabled ? &counters : nullptr;
+    }
+
+    /**
+     * Returns monotonic time in nanoseconds if timed, otherwise 0.
+     * @param timed : whether time is measured
+     */
+    static uint64_t timestamp(bool timed) {
+        if (!timed)
+            return 0;
+        return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * Ends the current phase of the run, if any, and starts the next one.
+     * @param name : name of the next phase
+     */
+    void startPhase(const char *name) {
+        if (!isEnabled)
+            return;
+        endPhase();
+        phaseName = name;
+        wallStart = timestamp(true);
+        cpuStart = cpuTime();
+    }
+
+    /** Ends the current phase of the run, if any. */
+    void endPhase() {
+        if (phaseName == nullptr)
+            return;
+        phases.push_back(Phase{phaseName, timestamp(true) - wallStart,
+                               cpuTime() - cpuStart});
+        phaseName = nullptr;
     }
-}
+
+    /**
+     * Prints statistics on the standard error.
+     * @param json : whether statistics are printed as a JSON object
+     */
+    void report(bool json) {
+        endPhase();
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        uint64_t peakMemory = (uint64_t)usage.ru_maxrss;
+        ostringstream out;
+        out << fixed << setprecision(6);
+
+        if (json) {
+            out << "{\"phases\":[";
+            for (size_t i = 0; i < phases.size(); ++i) {
+                out << (i == 0 ? "" : ",") << "{\"name\":\"" << phases[i].name
+                    << "\",\"wall_s\":" << seconds(phases[i].wallNanos)
+                    << ",\"cpu_s\":" << seconds(phases[i].cpuNanos) << "}";
+            }
+            out << "],\"gates_valuated\":" << gatesValuated
+                << ",\"rows\":" << rows
+                << ",\"bytes_written\":" << bytesWritten
+                << ",\"hash_lookups\":" << counters.hashLookups
+                << ",\"valuation_s\":" << seconds(valuationNanos)
+                << ",\"formatting_s\":" << seconds(formattingNanos)
+                << ",\"writing_s\":" << seconds(writingNanos)
+                << ",\"peak_memory_kib\":" << peakMemory << "}\n";
+        } else {
+            for (auto const &phase : phases) {
+                out << "Phase " << phase.name << ": "
+                    << seconds(phase.wallNanos) << " s wall, "
+                    << seconds(phase.cpuNanos) << " s CPU.\n";
+            }
+            out << "Gates valuated: " << gatesValuated << ".\n"
+                << "Rows: " << rows << ".\n"
+                << "Bytes written: " << bytesWritten << ".\n"
+                << "Hash lookups: " << counters.hashLookups << ".\n"
+                << "Thread time of valuation: " << seconds(valuationNanos)
+                << " s, formatting: " << seconds(formattingNanos)
+                << " s, writing: " << seconds(writingNanos) << " s.\n"
+                << "Peak memory: " << peakMemory << " KiB.\n";
+        }
+        cerr << out.str();
+    }
+
+private:
+    struct Phase {
+        const char *name;
+        uint64_t wallNanos;
+        uint64_t cpuNanos;
+    };
+
+    bool isEnabled = false;
+    vector<Phase> phases;
+    const char *phaseName = nullptr;
+    uint64_t wallStart = 0;
+    uint64_t cpuStart = 0;
+
+    /** CPU time of all threads of the process in nanoseconds. */
+    static uint64_t cpuTime() {
+        struct timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    }
+
+    static double seconds(uint64_t nanos) {
+        return (double)nanos / 1e9;
+    }
+};
+
+/** Statistics of the run. */
+static Statistics statistics;
+
+/** Layout of printed rows. */
+struct RowLayout {
+    OutputFormat format;
+    /** Number of printed signals. */
+    size_t columns;
+    /** Number of bytes of a single row. */
+    size_t width;
+    /** Indices of signals holding values of printed signals. */
+    vector<uint32_t> slots;
+};
 
 /**
- * Checks if name of the gate is correct.
- * @param gateName : name of the gate
- * @return true if name is correct, otherwise false
+ * Buffers output and writes it to a file descriptor in large blocks.
  */
-static bool correctGateName(string &gateName) {
-    return regex_match(gateName, regex("NOT|XOR|AND|NAND|OR|NOR"));
-}
+class OutputWriter {
+public:
+    explicit OutputWriter(int fd) : fd(fd) {
+        buffer.reserve(BUFFER_SIZE);
+    }
+
+    OutputWriter(const OutputWriter &) = delete;
+
+    OutputWriter &operator=(const OutputWriter &) = delete;
+
+    ~OutputWriter() {
+        flush();
+    }
+
+    void write(string_view data) {
+        if (buffer.size() + data.size() <= BUFFER_SIZE) {
+            buffer.append(data);
+            return;
+        }
+        flush();
+        if (data.size() < BUFFER_SIZE)
+            buffer.append(data);
+        else
+            writeAll(data);
+    }
+
+    /**
+     * Writes all buffered data.
+     * @return true if all data written so far was written, otherwise false
+     */
+    bool flush() {
+        writeAll(buffer);
+        buffer.clear();
+        return !failed;
+    }
+
+    /** Flushes buffered data and closes the file descriptor. */
+    void close() {
+        flush();
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+private:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    int fd;
+    string buffer;
+    bool failed = false;
+
+    void writeAll(string_view data) {
+        bool timed = statistics.enabled();
+        uint64_t start = Statistics::timestamp(timed);
+        if (timed && fd >= 0)
+            statistics.bytesWritten += data.size();
+
+        failed = failed || (fd < 0 && !data.empty());
+        while (!failed && !data.empty()) {
+            ssize_t written = ::write(fd, data.data(), data.size());
+            if (written > 0)
+                data.remove_prefix((size_t)written);
+            else if (written < 0 && errno != EINTR)
+                failed = true;
+        }
+
+        if (timed)
+            statistics.writingNanos += Statistics::timestamp(timed) - start;
+    }
+};
 
 /**
- * Checks if signal is correct. If it is, set its value on given variable.
- * @param sig : signal
- * @param curSig : signal value
- * @return true if signal is valid, otherwise false
+ * Contents of a file descriptor, mapped into memory if it is a regular file,
+ * otherwise read into a buffer in large blocks.
  */
-static bool correctSignal(string &sig, int32_t &curSig) {
-    if (regex_match(sig, regex("[0-9]+"))) {
-        stringstream(sig) >> curSig;
-        return curSig >= 1 && curSig <= 999999999;
+class InputBuffer {
+public:
+    explicit InputBuffer(int fd) {
+        struct stat st;
+
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *addr = mmap(nullptr, (size_t)st.st_size, PROT_READ,
+                              MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+                mapped = static_cast<char *>(addr);
+                mappedSize = (size_t)st.st_size;
+                return;
+            }
+        }
+
+        const size_t blockSize = 1 << 20;
+        size_t size = 0;
+        ssize_t got;
+
+        do {
+            buffer.resize(size + blockSize);
+            got = read(fd, buffer.data() + size, blockSize);
+            if (got > 0)
+                size += (size_t)got;
+        } while (got > 0 || (got < 0 && errno == EINTR));
+
+        buffer.resize(size);
     }
-    return false;
-}
+
+    InputBuffer(const InputBuffer &) = delete;
+
+    InputBuffer &operator=(const InputBuffer &) = delete;
+
+    ~InputBuffer() {
+        if (mapped != nullptr)
+            munmap(mapped, mappedSize);
+    }
+
+    string_view contents() const {
+        if (mapped != nullptr)
+            return string_view(mapped, mappedSize);
+        return string_view(buffer.data(), buffer.size());
+    }
+
+private:
+    char *mapped = nullptr;
+    size_t mappedSize = 0;
+    string buffer;
+};
 
 /**
  * Parses input.
  * If any error appears during parsing input, then false is returned and the
  * program is terminated (the second element of the pair is discarded).
  * Otherwise, true and graph storing connections is returned.
+ * @param fd : file descriptor of the netlist
  * @return pair: (input correctness, graph)
  */
-static pair<bool, graph> parseInput() {
+static pair<bool, graph> parseInput(int fd) {
+    InputBuffer input(fd);
     graph g;
-    string line;
-    size_t lineCount = 0;
-    bool correctInput = true;
+    bool correctInput = parseNetlist(input.contents(), g, cerr,
+                                     statistics.libraryCounters());
+    return make_pair(correctInput, g);
+}
 
-    while (getline(cin, line)) {
-        ++lineCount;
-        bool correctLine = true;
-        stringstream str(line);
-        string gateName;
-        str >> gateName;
-
-        // check gate name
-        if (!correctGateName(gateName)) {
-            correctInput = correctLine = false;
-            cerr << "Error in line " << lineCount << ": " << line << "\n";
-            continue;
-        }
+/**
+ * Reads lines from a file descriptor in large blocks, without holding more
+ * than a block in memory.
+ */
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd(fd) {}
 
-        Gate curGate = createGate(gateName);
-        string outSig;
-        int32_t curOutSig;
-        str >> outSig;
+    /**
+     * Finds the next line, without the newline character.
+     * @param line : set to the line, valid until the next call
+     * @return true if there was a line, otherwise false
+     */
+    bool next(string_view &line) {
+        while (true) {
+            size_t newline = buffer.find('\n', start);
+            if (newline < end) {
+                line = string_view(buffer).substr(start, newline - start);
+                start = newline + 1;
+                return true;
+            }
+            if (finished) {
+                if (start == end)
+                    return false;
+                line = string_view(buffer).substr(start, end - start);
+                start = end;
+                return true;
+            }
 
-        // check if signal is a number in correct range
-        if (!correctSignal(outSig, curOutSig)) {
-            correctInput = correctLine = false;
-            cerr << "Error in line " << lineCount << ": " << line << "\n";
-            continue;
+            // move the incomplete line to the front and read more
+            buffer.erase(0, start);
+            end -= start;
+            start = 0;
+            if (buffer.size() < end + BLOCK_SIZE)
+                buffer.resize(end + BLOCK_SIZE);
+
+            ssize_t got = read(fd, buffer.data() + end, BLOCK_SIZE);
+            if (got > 0)
+                end += (size_t)got;
+            else if (got == 0 || errno != EINTR)
+                finished = true;
+            buffer.resize(max(end, buffer.size()));
+            fill(buffer.begin() + (long)end, buffer.end(), 0);
         }
+    }
 
-        string inSig;
-        unordered_set<int32_t> parents;
-        size_t count = 0;
+private:
+    static const size_t BLOCK_SIZE = 1 << 20;
 
-        while (str >> inSig) {
-            int32_t curInSig;
+    int fd;
+    string buffer;
+    /** Unread data occupies buffer from start to end. */
+    size_t start = 0;
+    size_t end = 0;
+    bool finished = false;
+};
 
-            if (!correctSignal(inSig, curInSig)) {
-                correctInput = correctLine = false;
-                cerr << "Error in line " << lineCount << ": " << line << "\n";
-                break;
+/**
+ * Generates C source of a function valuating all instructions of the
+ * netlist, equivalent to populateValuation without input signals. Long
+ * netlists are split into several functions to keep compilation fast.
+ * @param netlist : netlist with instructions sorted topologically
+ * @return source code defining nysa_valuate(uint64_t *values)
+ */
+static string generateKernelSource(const Netlist &netlist) {
+    string source = "#include <stdint.h>\n";
+    size_t parts = 0;
+
+    for (size_t k = 0; k < netlist.instructions.size(); ++k) {
+        if (k % KERNEL_PART_INSTRUCTIONS == 0) {
+            if (k != 0)
+                source += "}\n";
+            source += "static void part" + to_string(parts++)
+                      + "(uint64_t *v) {\n";
+        }
+
+        Instruction const &inst = netlist.instructions[k];
+        const uint32_t *parents = netlist.operands.data() + inst.firstOperand;
+        bool negated = inst.gate == NOT || inst.gate == NAND
+                       || inst.gate == NOR;
+        const char *op = inst.gate == XOR ? " ^ "
+                         : inst.gate == AND || inst.gate == NAND ? " & "
+                         : " | ";
+        string expression;
+
+        if (inst.gate == XOR && inst.operandCount == 1) {
+            // gate with 2 identical input streams is always false
+            expression = "0";
+        } else if (inst.operandCount == 0) {
+            // constants are valuated by AND and OR gates without operands
+            expression = inst.gate == AND ? "~(uint64_t)0" : "0";
+        } else {
+            for (uint32_t i = 0; i < inst.operandCount; ++i) {
+                if (i != 0)
+                    expression += op;
+                expression += "v[" + to_string(parents[i]) + "]";
             }
+        }
 
-            parents.insert(curInSig);
-            ++count;
+        source += "v[" + to_string(inst.output) + "] = "
+                  + (negated ? "~(" + expression + ")" : expression) + ";\n";
+    }
+    if (parts != 0)
+        source += "}\n";
 
-            // check if the number of input signals is correct
-            if ((curGate == NOT && count > 1) || (curGate == XOR && count > 2))
-                break;
+    source += "void nysa_valuate(uint64_t *v) {\n";
+    for (size_t i = 0; i < parts; ++i)
+        source += "part" + to_string(i) + "(v);\n";
+    source += "}\n";
+    return source;
+}
+
+/**
+ * Netlist compiled to native code. The source is built with the compiler
+ * given in CC environment variable, or cc by default, into a shared object
+ * loaded with dlopen. If anything fails, a warning is printed and kernel
+ * is null, so that the netlist is interpreted.
+ */
+class NativeKernel {
+public:
+    explicit NativeKernel(const Netlist &netlist) {
+        char dirTemplate[] = "/tmp/nysa-XXXXXX";
+        if (mkdtemp(dirTemplate) == nullptr) {
+            warn("cannot create a temporary directory");
+            return;
         }
 
-        if (correctLine && !correctNumberOfSignals(curGate, count)) {
-            correctInput = correctLine = false;
-            cerr << "Error in line " << lineCount << ": " << line << "\n";
-            continue;
-        } else if (correctLine && g.contains(curOutSig)) {
-            correctInput = correctLine = false;
-            cerr << "Error in line " << lineCount << ": "
-                 << "signal ";
-            cerr << curOutSig << " is assigned to multiple outputs.\n";
-            continue;
+        string dir = dirTemplate;
+        string sourcePath = dir + "/kernel.c";
+        string libraryPath = dir + "/kernel.so";
+        const char *compiler = getenv("CC");
+        string command = string(compiler != nullptr && *compiler != 0
+                                ? compiler : "cc")
+                         + " -O2 -shared -fPIC -o " + libraryPath + " "
+                         + sourcePath + " >/dev/null 2>&1";
+
+        {
+            OutputWriter source(open(sourcePath.c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0600));
+            source.write(generateKernelSource(netlist));
+            if (!source.flush())
+                warn("cannot write the generated source");
+            else if (system(command.c_str()) != 0)
+                warn("the compiler failed or is not available");
+            else if ((handle = dlopen(libraryPath.c_str(), RTLD_NOW))
+                     == nullptr)
+                warn("cannot load the compiled circuit");
+            else if ((function = reinterpret_cast<Kernel>(
+                    dlsym(handle, "nysa_valuate"))) == nullptr)
+                warn("cannot find the compiled function");
+            source.close();
         }
 
-        if (correctLine)
-            g.insert(make_pair(curOutSig, make_pair(curGate, parents)));
+        // the loaded library stays mapped after its file is removed
+        unlink(sourcePath.c_str());
+        unlink(libraryPath.c_str());
+        rmdir(dir.c_str());
     }
-    return make_pair(correctInput, g);
+
+    NativeKernel(const NativeKernel &) = delete;
+
+    NativeKernel &operator=(const NativeKernel &) = delete;
+
+    ~NativeKernel() {
+        if (handle != nullptr)
+            dlclose(handle);
+    }
+
+    /** Compiled function or null if compilation failed. */
+    Kernel kernel() const {
+        return function;
+    }
+
+private:
+    void *handle = nullptr;
+    Kernel function = nullptr;
+
+    static void warn(const char *reason) {
+        cerr << "Warning: " << reason << ", the circuit is interpreted.\n";
+    }
+};
+
+/**
+ * Creates layout of rows printing given signals.
+ * @param slots : indices of signals holding values of printed signals
+ * @param format : output format
+ * @return layout of rows
+ */
+static RowLayout createRowLayout(const vector<uint32_t> &slots,
+                                 OutputFormat format) {
+    size_t columns = slots.size();
+    if (format == BINARY)
+        return RowLayout{format, columns, (columns + 7) / 8, slots};
+    return RowLayout{format, columns, columns + 1, slots};
 }
 
 /**
- * Preforms DFS on the given graph and marks nodes that are in the current
- * recursion stack
- * @param g : graph
- * @param currentNode : node that is currently being visited
- * @param activeNodes : nodes that are being visited in the dfs stack
- * @param visitedNodes : nodes that were visited before
- * @return true iff there exists a cycle that contains currentNode
+ * Formats a single row.
+ * @param layout : layout of rows
+ * @param values : values of all signals
+ * @param lane : number of the bit holding values of this row, bits beyond
+ * the first word of a slot are in the following words
+ * @param dst : beginning of the row in the output, layout.width bytes long
  */
-static bool dfsWithActiveNodes(graph &g, int32_t currentNode,
-                               unordered_set<int32_t> &activeNodes,
-                               unordered_set<int32_t> &visitedNodes) {
-    if (!g.contains(currentNode)) {
-        // currentNode has no parents, it cannot be a part of a cycle
-        return false;
+static void formatRow(const RowLayout &layout, const vector<word> &values,
+                      size_t lane, char *dst) {
+    const word *words = values.data() + lane / WORD_BITS;
+    lane %= WORD_BITS;
+
+    if (layout.format == TEXT) {
+        for (size_t i = 0; i < layout.columns; ++i)
+            dst[i] = (char)('0' + ((words[layout.slots[i]] >> lane) & 1));
+        dst[layout.columns] = '\n';
+        return;
     }
-    if (activeNodes.contains(currentNode)) {
-        // currentNode is in the current recursion stack, there is a cycle!
-        return true;
-    }
-    // mark currentNode as active
-    activeNodes.insert(currentNode);
-    // visit all unvisited parents of the current node
-    for (auto const &parent : g.find(currentNode)->second.second) {
-        if (!visitedNodes.contains(parent)) {
-            if (dfsWithActiveNodes(g, parent, activeNodes, visitedNodes)) {
-                // if any of parents is a part of a cycle, return true
-                return true;
+
+    for (size_t byte = 0, i = 0; byte < layout.width; ++byte) {
+        unsigned bits = 0;
+        for (size_t end = min(i + 8, layout.columns); i < end; ++i)
+            bits = (bits << 1)
+                   | (unsigned)((words[layout.slots[i]] >> lane) & 1);
+        // the last byte is padded with zeros
+        dst[byte] = (char)(bits << (8 - min<size_t>(8, layout.columns
+                                                          - byte * 8)));
+    }
+}
+
+/**
+ * Appends given valuation of consecutive rows to output.
+ * @param layout : layout of rows
+ * @param values : values of all signals, bit r of each word belongs to r-th
+ * row, rows beyond WORD_BITS are in the following words
+ * @param firstLane : number of the first row to append
+ * @param lastLane : number of the row after the last one to append
+ * @param out : output
+ */
+static void printValuation(const RowLayout &layout, const vector<word> &values,
+                           size_t firstLane, size_t lastLane, string &out) {
+    size_t pos = out.size();
+    out.resize(pos + layout.width * (lastLane - firstLane));
+
+    for (size_t r = firstLane; r < lastLane; ++r, pos += layout.width)
+        formatRow(layout, values, r, out.data() + pos);
+}
+
+/**
+ * Valuates rows from given range and appends them to output.
+ * @param netlist : netlist
+ * @param layout : layout of rows
+ * @param firstRow : number of the first row
+ * @param lastRow : number of the row after the last one
+ * @param out : output
+ */
+static void printRows(const Netlist &netlist, const RowLayout &layout,
+                      size_t firstRow, size_t lastRow, string &out) {
+    vector<word> values(netlist.signalIds.size());
+    bool timed = statistics.enabled();
+    uint64_t valuationNanos = 0;
+    uint64_t formattingNanos = 0;
+    uint64_t blocks = 0;
+
+    for (size_t block = firstRow - firstRow % WORD_BITS; block < lastRow;
+         block += WORD_BITS, ++blocks) {
+        uint64_t start = Statistics::timestamp(timed);
+        populateValuation(netlist, values, block);
+        uint64_t valuated = Statistics::timestamp(timed);
+        printValuation(layout, values, max(block, firstRow) - block,
+                       min(block + WORD_BITS, lastRow) - block, out);
+        valuationNanos += valuated - start;
+        formattingNanos += Statistics::timestamp(timed) - valuated;
+    }
+
+    if (timed) {
+        statistics.gatesValuated += blocks * netlist.instructions.size();
+        statistics.valuationNanos += valuationNanos;
+        statistics.formattingNanos += formattingNanos;
+    }
+}
+
+/**
+ * Valuates rows from given range in blocks of BLOCK_ROWS and appends them
+ * to output.
+ * @param netlist : netlist
+ * @param layout : layout of rows, slots are indices of first words of
+ * signals in a block
+ * @param firstRow : number of the first row
+ * @param lastRow : number of the row after the last one
+ * @param out : output
+ */
+static void printBlockRows(const Netlist &netlist, const RowLayout &layout,
+                           size_t firstRow, size_t lastRow, string &out) {
+    vector<word> values(netlist.signalIds.size() * BLOCK_WORDS);
+    bool timed = statistics.enabled();
+    uint64_t valuationNanos = 0;
+    uint64_t formattingNanos = 0;
+    uint64_t blocks = 0;
+
+    for (size_t block = firstRow - firstRow % BLOCK_ROWS; block < lastRow;
+         block += BLOCK_ROWS, ++blocks) {
+        uint64_t start = Statistics::timestamp(timed);
+        populateBlock(netlist, values, block);
+        uint64_t valuated = Statistics::timestamp(timed);
+        printValuation(layout, values, max(block, firstRow) - block,
+                       min(block + BLOCK_ROWS, lastRow) - block, out);
+        valuationNanos += valuated - start;
+        formattingNanos += Statistics::timestamp(timed) - valuated;
+    }
+
+    if (timed) {
+        statistics.gatesValuated += blocks * BLOCK_WORDS
+                                    * netlist.instructions.size();
+        statistics.valuationNanos += valuationNanos;
+        statistics.formattingNanos += formattingNanos;
+    }
+}
+
+/**
+ * Finds fan-out cones of input signals, i.e. instructions that have to be
+ * valuated again after the value of the input signal changes.
+ * @param netlist : netlist
+ * @return positions of instructions of every cone in ascending order, cones
+ * are ordered as input signals in netlist
+ */
+static vector<vector<uint32_t>> findInputCones(const Netlist &netlist) {
+    size_t signalCount = netlist.signalIds.size();
+    vector<vector<uint32_t>> readers(signalCount);
+
+    for (size_t k = 0; k < netlist.instructions.size(); ++k) {
+        Instruction const &inst = netlist.instructions[k];
+        for (uint32_t i = 0; i < inst.operandCount; ++i)
+            readers[netlist.operands[inst.firstOperand + i]].push_back(
+                    (uint32_t)k);
+    }
+
+    vector<vector<uint32_t>> cones;
+    vector<size_t> visitedBy(netlist.instructions.size(), SIZE_MAX);
+
+    for (size_t j = 0; j < netlist.inputs.size(); ++j) {
+        vector<uint32_t> cone;
+        vector<uint32_t> stack(readers[netlist.inputs[j]]);
+
+        while (!stack.empty()) {
+            uint32_t k = stack.back();
+            stack.pop_back();
+            if (visitedBy[k] == j)
+                continue;
+            visitedBy[k] = j;
+            cone.push_back(k);
+            for (auto reader : readers[netlist.instructions[k].output])
+                stack.push_back(reader);
+        }
+        sort(cone.begin(), cone.end());
+        cones.push_back(move(cone));
+    }
+    return cones;
+}
+
+/**
+ * Valuates rows from given range one by one and appends them to output.
+ * Rows of every aligned block of GRAY_BLOCK_ROWS are visited in Gray code
+ * order, so that only one input signal changes between consecutive rows and
+ * only its fan-out cone is valuated again. Rows are appended in binary order.
+ * @param netlist : netlist
+ * @param cones : fan-out cones of input signals
+ * @param layout : layout of rows
+ * @param firstRow : number of the first row
+ * @param lastRow : number of the row after the last one
+ * @param out : output
+ */
+static void printRowsInGrayOrder(const Netlist &netlist,
+                                 const vector<vector<uint32_t>> &cones,
+                                 const RowLayout &layout, size_t firstRow,
+                                 size_t lastRow, string &out) {
+    // every word holds value of the signal in all of its bits
+    vector<word> values(netlist.signalIds.size());
+    size_t n = netlist.inputs.size();
+    size_t width = layout.width;
+    size_t blockRows = min(GRAY_BLOCK_ROWS, (size_t)1 << n);
+    string block;
+    uint64_t valuated = 0;
+
+    for (size_t base = firstRow - firstRow % blockRows; base < lastRow;
+         base += blockRows) {
+        size_t first = max(base, firstRow) - base;
+        size_t last = min(base + blockRows, lastRow) - base;
+        block.resize(width * (last - first));
+
+        for (size_t i = 0; i < blockRows; ++i) {
+            if (i == 0) {
+                for (size_t j = 0; j < n; ++j)
+                    values[netlist.inputs[j]] =
+                            ((base >> (n - 1 - j)) & 1) != 0 ? ~word(0) : 0;
+                for (auto const &inst : netlist.instructions)
+                    values[inst.output] = valuateSignalBasedOnParentsAndGate(
+                            inst, netlist.operands, values);
+                valuated += netlist.instructions.size();
+            } else {
+                // i-th Gray code differs from the previous one on this bit
+                size_t j = n - 1 - (size_t)countr_zero(i);
+                values[netlist.inputs[j]] = ~values[netlist.inputs[j]];
+                valuated += cones[j].size();
+                for (auto k : cones[j]) {
+                    Instruction const &inst = netlist.instructions[k];
+                    values[inst.output] = valuateSignalBasedOnParentsAndGate(
+                            inst, netlist.operands, values);
+                }
             }
+
+            size_t row = i ^ (i >> 1);
+            if (row < first || row >= last)
+                continue;
+
+            formatRow(layout, values, 0, block.data() + (row - first) * width);
         }
+        out += block;
     }
-    // currentNode is no longer active
-    activeNodes.erase(currentNode);
-    // mark currentNode as visited
-    visitedNodes.insert(currentNode);
-    return false;
+
+    if (statistics.enabled())
+        statistics.gatesValuated += valuated;
 }
 
 /**
- * Detects cycle in a graph
- * @param g : graph
- * @return true iff given graph contains cycle
+ * Event-driven simulator of circuits with feedback loops. Signals keep their
+ * values between consecutive rows, so the circuit may hold state. After
+ * input signals change, only gates reading a changed signal are valuated
+ * again, all of them at once from values of the previous delta cycle, until
+ * no signal changes.
  */
-static bool hasCycle(graph &g) {
-    unordered_set<int32_t> activeNodes;
-    unordered_set<int32_t> visitedNodes;
+class SequentialSimulator {
+public:
+    explicit SequentialSimulator(const Netlist &netlist)
+            : netlist(netlist), values(netlist.signalIds.size(), 0),
+              unstable(netlist.signalIds.size(), false),
+              readerStart(netlist.signalIds.size() + 1, 0),
+              scheduledIn(netlist.instructions.size(), 0),
+              maxDeltaCycles(4 * netlist.instructions.size() + 64) {
+        for (auto signal : netlist.operands)
+            ++readerStart[signal + 1];
+        for (size_t i = 0; i + 1 < readerStart.size(); ++i)
+            readerStart[i + 1] += readerStart[i];
 
-    // start looking for cycle from nodes that have parents
-    for (auto const &node : g) {
-        // if any node is a part of a cycle, return true
-        if (dfsWithActiveNodes(g, node.first, activeNodes, visitedNodes)) {
-            return true;
+        readers.resize(netlist.operands.size());
+        vector<uint32_t> end(readerStart.begin(), readerStart.end() - 1);
+        for (size_t k = 0; k < netlist.instructions.size(); ++k) {
+            Instruction const &inst = netlist.instructions[k];
+            for (uint32_t i = 0; i < inst.operandCount; ++i)
+                readers[end[netlist.operands[inst.firstOperand + i]]++] =
+                        (uint32_t)k;
         }
+
+        // all gates are valuated when the circuit is powered on
+        for (size_t k = 0; k < netlist.instructions.size(); ++k)
+            current.push_back((uint32_t)k);
+    }
+
+    /**
+     * Sets input signals to the given row and propagates changes.
+     * @param row : number of the row
+     * @return true if all signals stabilized, otherwise false; in that case
+     * signals that kept changing are marked as unstable
+     */
+    bool settle(size_t row) {
+        size_t n = netlist.inputs.size();
+        bool stable = true;
+        fill(unstable.begin(), unstable.end(), false);
+
+        for (size_t j = 0; j < n; ++j) {
+            word value = ((row >> (n - 1 - j)) & 1) != 0 ? ~word(0) : 0;
+            if (values[netlist.inputs[j]] != value) {
+                values[netlist.inputs[j]] = value;
+                scheduleReaders(netlist.inputs[j]);
+            }
+        }
+
+        // after maxDeltaCycles the circuit is considered oscillating, signals
+        // changing in the following cycles are unstable; pending changes are
+        // propagated in the next row
+        for (size_t cycles = 0; !current.empty() && cycles < 2 * maxDeltaCycles;
+             ++cycles) {
+            bool oscillating = cycles >= maxDeltaCycles;
+            stable = stable && !oscillating;
+
+            changes.clear();
+            valuated += current.size();
+            for (auto k : current) {
+                Instruction const &inst = netlist.instructions[k];
+                word value = valuateSignalBasedOnParentsAndGate(
+                        inst, netlist.operands, values);
+                if (value != values[inst.output])
+                    changes.emplace_back(inst.output, value);
+            }
+
+            ++deltaCycle;
+            current.clear();
+            for (auto const &[signal, value] : changes) {
+                values[signal] = value;
+                unstable[signal] = unstable[signal] || oscillating;
+                scheduleReaders(signal);
+            }
+        }
+        return stable;
+    }
+
+    /** Values of all signals, every word has all bits equal. */
+    const vector<word> &signalValues() const {
+        return values;
+    }
+
+    /** Signals that did not stabilize in the last row. */
+    const vector<char> &unstableSignals() const {
+        return unstable;
+    }
+
+    /** Number of gates valuated so far. */
+    uint64_t valuatedGates() const {
+        return valuated;
+    }
+
+private:
+    const Netlist &netlist;
+    vector<word> values;
+    vector<char> unstable;
+    /** Instructions reading each signal, in CSR form. */
+    vector<uint32_t> readerStart;
+    vector<uint32_t> readers;
+    /** Instructions to valuate in the current delta cycle. */
+    vector<uint32_t> current;
+    /** Delta cycle in which each instruction was last scheduled. */
+    vector<size_t> scheduledIn;
+    vector<pair<uint32_t, word>> changes;
+    size_t deltaCycle = 0;
+    size_t maxDeltaCycles;
+    uint64_t valuated = 0;
+
+    void scheduleReaders(uint32_t signal) {
+        for (uint32_t i = readerStart[signal]; i < readerStart[signal + 1];
+             ++i) {
+            uint32_t k = readers[i];
+            if (scheduledIn[k] != deltaCycle) {
+                scheduledIn[k] = deltaCycle;
+                current.push_back(k);
+            }
+        }
+    }
+};
+
+/**
+ * Simulates sequential circuit for consecutive rows and prints rows from
+ * given range. Rows before the range are simulated too, since the state of
+ * the circuit depends on them. Signals that do not stabilize are printed as
+ * 'X' in text format and reported on the standard error.
+ * @param netlist : netlist
+ * @param layout : layout of rows
+ * @param firstRow : number of the first row
+ * @param lastRow : number of the row after the last one
+ * @param writer : output writer
+ */
+static void printSequentialRows(const Netlist &netlist,
+                                const RowLayout &layout, size_t firstRow,
+                                size_t lastRow, OutputWriter &writer) {
+    SequentialSimulator simulator(netlist);
+    string out;
+
+    for (size_t row = 0; row < lastRow; ++row) {
+        bool stable = simulator.settle(row);
+
+        if (!stable)
+            cerr << "Warning: signals do not stabilize in row " << row
+                 << ".\n";
+        if (row < firstRow)
+            continue;
+
+        size_t pos = out.size();
+        out.resize(pos + layout.width);
+        formatRow(layout, simulator.signalValues(), 0, out.data() + pos);
+
+        if (!stable && layout.format == TEXT) {
+            vector<char> const &unstable = simulator.unstableSignals();
+            for (size_t i = 0; i < layout.columns; ++i) {
+                if (unstable[layout.slots[i]])
+                    out[pos + i] = 'X';
+            }
+        }
+
+        if (out.size() >= CHUNK_ROWS * layout.width) {
+            writer.write(out);
+            out.clear();
+        }
+    }
+    writer.write(out);
+
+    if (statistics.enabled()) {
+        statistics.gatesValuated += simulator.valuatedGates();
+        statistics.rows += lastRow - firstRow;
     }
-    return false;
 }
 
 /**
- * Finds ids of signals that are input signals
- * @param g : graph
- * @return vector with input signals' ids
+ * Prints rows from given range, chunks of rows are formatted by worker
+ * threads and printed in the original order by the calling thread.
+ * @param writer : output writer
+ * @param firstRow : number of the first row
+ * @param lastRow : number of the row after the last one
+ * @param threads : number of worker threads
+ * @param formatRows : function appending rows from given range to output
  */
-static unordered_set<int32_t> findInputSignals(graph &g) {
-    // set with signals that have at least one parent
-    unordered_set<int32_t> children;
+static void printRowsInOrder(OutputWriter &writer, size_t firstRow,
+                             size_t lastRow, size_t threads,
+                             const function<void(size_t, size_t, string &)>
+                                     &formatRows) {
+    if (firstRow >= lastRow)
+        return;
+    if (statistics.enabled())
+        statistics.rows += lastRow - firstRow;
+
+    // chunks are aligned to multiples of CHUNK_ROWS, except for the first
+    // and the last one
+    size_t alignedFirst = firstRow - firstRow % CHUNK_ROWS;
+    size_t chunkCount = (lastRow - alignedFirst - 1) / CHUNK_ROWS + 1;
+    auto chunkRows = [&](size_t c, string &out) {
+        size_t first = alignedFirst + c * CHUNK_ROWS;
+        formatRows(max(first, firstRow), min(first + CHUNK_ROWS, lastRow), out);
+    };
+    string out;
 
-    for (auto const &pair : g) {
-        children.insert(pair.first);
+    if (threads <= 1 || chunkCount <= 1) {
+        for (size_t c = 0; c < chunkCount; ++c) {
+            out.clear();
+            chunkRows(c, out);
+            writer.write(out);
+        }
+        return;
     }
 
-    unordered_set<int32_t> inputSignals;
+    // formatted chunks wait in the reorder buffer until all previous ones
+    // are printed, window bounds the number of chunks held in memory
+    size_t window = 2 * threads;
+    vector<string> buffer(window);
+    vector<char> ready(window, false);
+    size_t printed = 0;
+    atomic<size_t> nextChunk = 0;
+    mutex m;
+    condition_variable cv;
+
+    auto worker = [&]() {
+        string chunk;
 
-    // traverse all signals and add to set iff they do not have any parent
-    for (auto const &pair : g) {
-        for (auto const &parent : pair.second.second) {
-            if (!children.contains(parent)) {
-                inputSignals.insert(parent);
+        for (size_t c; (c = nextChunk++) < chunkCount;) {
+            {
+                unique_lock<mutex> lock(m);
+                cv.wait(lock, [&]() { return c < printed + window; });
             }
+            chunk.clear();
+            chunkRows(c, chunk);
+
+            lock_guard<mutex> lock(m);
+            buffer[c % window].swap(chunk);
+            ready[c % window] = true;
+            cv.notify_all();
         }
+    };
+
+    vector<thread> workers;
+    for (size_t i = 0; i < threads; ++i)
+        workers.emplace_back(worker);
+
+    for (size_t c = 0; c < chunkCount; ++c) {
+        {
+            unique_lock<mutex> lock(m);
+            cv.wait(lock, [&]() { return ready[c % window]; });
+            out.swap(buffer[c % window]);
+            ready[c % window] = false;
+            ++printed;
+            cv.notify_all();
+        }
+        writer.write(out);
     }
-    return inputSignals;
+
+    for (auto &w : workers)
+        w.join();
 }
 
 /**
- * Fills the bitset of given size with binary representation of given number.
- * @param n : number
- * @param size : size of bitset
- * @param bitset : bitset
+ * Finds range of rows selected by options.
+ * @param options : options given in command line
+ * @param inputCount : number of input signals
+ * @param first : set to number of the first selected row
+ * @param last : set to number of the row after the last selected one
+ * @return true if the range is correct, otherwise false
  */
-static void toBinary(size_t n, size_t size, vector<char> &bitset) {
-    size_t i = size - 1;
+static bool selectRows(const Options &options, size_t inputCount,
+                       size_t &first, size_t &last) {
+    if (inputCount > MAX_INPUT_SIGNALS) {
+        cerr << "Error: truth table with " << inputCount
+             << " input signals has too many rows.\n";
+        return false;
+    }
+
+    size_t rowCount = (size_t)1 << inputCount;
+    first = 0;
+    last = rowCount;
 
-    while (n != 0) {
-        bitset[i] = n % 2 != 0;
-        n /= 2;
-        --i;
+    if (options.shardCount != 0) {
+        // rows are split as evenly as possible, consecutive shards meet
+        first = (size_t)((unsigned __int128)rowCount * options.shard
+                         / options.shardCount);
+        last = (size_t)((unsigned __int128)rowCount * (options.shard + 1)
+                        / options.shardCount);
+    } else if (options.rowsGiven) {
+        if (options.firstRow > options.lastRow || options.lastRow > rowCount) {
+            cerr << "Error: rows " << options.firstRow << ":"
+                 << options.lastRow << " are out of range 0:" << rowCount
+                 << ".\n";
+            return false;
+        }
+        first = options.firstRow;
+        last = options.lastRow;
     }
+    return true;
 }
 
 /**
- * Returns ids of signals that are not input signals
- * @param g : graph
- * @return unordered set with all signals' ids
+ * Selects printed signals. If outputs are given, these are the outputs and
+ * input signals of their cones, otherwise all signals.
+ * @param netlist : netlist of the cone of outputs
+ * @param options : options given in command line
+ * @return indices of printed signals in ascending order
  */
-static unordered_set<int32_t> getNonInputSignals(const graph &g) {
-    unordered_set<int32_t> signals;
+static vector<uint32_t> selectColumns(const Netlist &netlist,
+                                      const Options &options) {
+    vector<uint32_t> columns;
+
+    if (options.outputs.empty()) {
+        columns.resize(netlist.signalIds.size());
+        iota(columns.begin(), columns.end(), 0);
+        return columns;
+    }
 
-    for (auto const &pair : g) {
-        signals.insert(pair.first);
+    columns.assign(netlist.inputs.begin(), netlist.inputs.end());
+    for (auto id : options.outputs) {
+        auto it = lower_bound(netlist.signalIds.begin(),
+                              netlist.signalIds.end(), id);
+        columns.push_back((uint32_t)(it - netlist.signalIds.begin()));
     }
-    return signals;
+    sort(columns.begin(), columns.end());
+    columns.erase(unique(columns.begin(), columns.end()), columns.end());
+    return columns;
 }
 
 /**
- * Returns XOR of values passed in vector
- * @param signals : vector of signal values
- * @return boolean, result of XOR
+ * Produces valuations in correct order, populate and print them.
+ * Rows are valuated in blocks of WORD_BITS, each signal holds one word in
+ * which r-th bit is its value in r-th row of the block.
+ * Circuits with cycles are simulated row by row, see SequentialSimulator.
+ * @param g : child to gate type and set of parents mapping
+ * @param options : options given in command line
+ * @param sequential : whether the graph contains a cycle
+ * @return true if the truth table was written, otherwise false
  */
-static bool gateXOR(const vector<char> &signals) {
-    if (signals.size() == 1) {
-        // gate must have 2 identical input streams
+static bool printTruthTable(graph &g, const Options &options,
+                            bool sequential) {
+    statistics.startPhase("compile");
+    Netlist netlist = compileNetlist(g);
+    netlist.columns = selectColumns(netlist, options);
+
+    if (!sequential && options.optimize)
+        optimizeNetlist(netlist, statistics.libraryCounters());
+
+    RowLayout layout = createRowLayout(netlist.columns, options.format);
+    size_t first, last;
+
+    if (!selectRows(options, netlist.inputs.size(), first, last))
         return false;
+
+    unique_ptr<NativeKernel> native;
+    if (options.compile && !sequential && options.engine == BITSLICE) {
+        native = make_unique<NativeKernel>(netlist);
+        netlist.kernel = native->kernel();
     }
-    if ((signals.at(0) && !signals.at(1))
-        || (!signals.at(0) && signals.at(1))) {
-        return true;
+
+    OutputWriter writer(STDOUT_FILENO);
+    statistics.startPhase("valuation");
+
+    if (sequential) {
+        printSequentialRows(netlist, layout, first, last, writer);
+    } else if (options.engine == GRAY) {
+        vector<vector<uint32_t>> cones = findInputCones(netlist);
+        printRowsInOrder(writer, first, last, options.threads,
+                         [&](size_t first, size_t last, string &out) {
+                             printRowsInGrayOrder(netlist, cones, layout,
+                                                  first, last, out);
+                         });
+    } else if (netlist.kernel != nullptr) {
+        printRowsInOrder(writer, first, last, options.threads,
+                         [&](size_t first, size_t last, string &out) {
+                             printRows(netlist, layout, first, last, out);
+                         });
+    } else {
+        vector<uint32_t> slots(layout.slots);
+        for (auto &slot : slots)
+            slot *= BLOCK_WORDS;
+        RowLayout blockLayout = createRowLayout(slots, options.format);
+        printRowsInOrder(writer, first, last, options.threads,
+                         [&](size_t first, size_t last, string &out) {
+                             printBlockRows(netlist, blockLayout, first, last,
+                                            out);
+                         });
+    }
+
+    statistics.startPhase("output");
+    if (!writer.flush()) {
+        cerr << "Error: cannot write the truth table.\n";
+        return false;
     }
-    return false;
+    return true;
 }
 
 /**
- * Returns AND of values passed in vector
- * @param signals : vector of signal values
- * @return boolean, result of AND
+ * Splits stuck-at faults of all signals into groups simulated at once.
+ * Faults are ordered by signals, stuck-at-0 before stuck-at-1. Fault i of a
+ * group is simulated in lane i + 1, lane 0 belongs to the circuit without
+ * faults.
+ * @param netlist : netlist with instructions sorted topologically
+ * @return groups of faults
  */
-static bool gateAND(const vector<char> &signals) {
-    for (auto signal : signals) {
-        if (!signal) {
-            return false;
+static vector<FaultGroup> createFaultGroups(const Netlist &netlist) {
+    // position after which the value of each signal is known
+    vector<uint32_t> position(netlist.signalIds.size(), 0);
+    for (size_t k = 0; k < netlist.instructions.size(); ++k)
+        position[netlist.instructions[k].output] = (uint32_t)(k + 1);
+
+    vector<FaultGroup> groups;
+    size_t faultCount = 2 * netlist.signalIds.size();
+
+    for (size_t first = 0; first < faultCount; first += FAULTS_PER_GROUP) {
+        FaultGroup group{first, min(FAULTS_PER_GROUP, faultCount - first), {}};
+
+        for (size_t i = 0; i < group.faultCount; ++i) {
+            auto signal = (uint32_t)((first + i) / 2);
+            word lane = word(1) << (i + 1);
+            if (group.injections.empty()
+                || group.injections.back().signal != signal)
+                group.injections.push_back(
+                        FaultInjection{position[signal], signal, 0, 0});
+            if ((first + i) % 2 == 0)
+                group.injections.back().stuckAt0 |= lane;
+            else
+                group.injections.back().stuckAt1 |= lane;
         }
+        sort(group.injections.begin(), group.injections.end(),
+             [](const FaultInjection &a, const FaultInjection &b) {
+                 return a.position < b.position;
+             });
+        groups.push_back(move(group));
     }
-    return true;
+    return groups;
 }
 
 /**
- * Returns OR of values passed in vector
- * @param signals : vector of signal values
- * @return boolean, result of OR
+ * Valuates all signals of the netlist for a single row, with faults of the
+ * group injected in their lanes.
+ * @param netlist : netlist with instructions sorted topologically
+ * @param group : group of faults
+ * @param outputs : signals observed to detect faults
+ * @param values : values of all signals
+ * @param row : number of the row
+ * @return word with bit i + 1 set iff i-th fault of the group is detected
  */
-static bool gateOR(const vector<char> &signals) {
-    for (auto signal : signals) {
-        if (signal) {
-            return true;
+static word simulateFaultGroup(const Netlist &netlist,
+                               const FaultGroup &group,
+                               const vector<uint32_t> &outputs,
+                               vector<word> &values, size_t row) {
+    size_t n = netlist.inputs.size();
+    auto injection = group.injections.begin();
+    auto inject = [&](uint32_t position) {
+        for (; injection != group.injections.end()
+               && injection->position == position; ++injection) {
+            word &value = values[injection->signal];
+            value = (value & ~injection->stuckAt0) | injection->stuckAt1;
         }
+    };
+
+    for (size_t j = 0; j < n; ++j)
+        values[netlist.inputs[j]] =
+                ((row >> (n - 1 - j)) & 1) != 0 ? ~word(0) : 0;
+    inject(0);
+
+    for (size_t k = 0; k < netlist.instructions.size(); ++k) {
+        Instruction const &inst = netlist.instructions[k];
+        values[inst.output] = valuateSignalBasedOnParentsAndGate(
+                inst, netlist.operands, values);
+        inject((uint32_t)(k + 1));
+    }
+
+    word difference = 0;
+    for (auto output : outputs) {
+        word correct = (values[output] & 1) != 0 ? ~word(0) : 0;
+        difference |= values[output] ^ correct;
     }
-    return false;
+    word lanes = group.faultCount + 1 < WORD_BITS
+                 ? (word(1) << (group.faultCount + 1)) - 1 : ~word(0);
+    return difference & lanes & ~word(1);
 }
 
 /**
- * Returns output signal from a set of input signal and gate type
- * @param parentSignals : vector of signals' values
- * @param gateType : enum denoting gate type
- * @return output signal's value
- */
-static bool
-valuateSignalBasedOnParentsAndGate(const vector<char> &parentSignals,
-                                   Gate gateType) {
-    switch (gateType) {
-        case NOT:
-            return !parentSignals.at(0);
-        case XOR:
-            return gateXOR(parentSignals);
-        case AND:
-            return gateAND(parentSignals);
-        case NAND:
-            return !gateAND(parentSignals);
-        case OR:
-            return gateOR(parentSignals);
-        case NOR:
-            return !gateOR(parentSignals);
-        default:
-            throw invalid_argument("invalid gate type!");
+ * Simulates all faults for rows from given range and appends rows of the
+ * fault table to output. Every row holds values of input signals followed
+ * by one column per fault, set iff the fault is detected by that row.
+ * @param netlist : netlist with instructions sorted topologically
+ * @param groups : groups of faults
+ * @param outputs : signals observed to detect faults
+ * @param layout : layout of rows
+ * @param firstRow : number of the first row
+ * @param lastRow : number of the row after the last one
+ * @param out : output
+ * @param detected : faults detected by any row, updated under lock
+ * @param detectedLock : lock of detected faults
+ */
+static void printFaultRows(const Netlist &netlist,
+                           const vector<FaultGroup> &groups,
+                           const vector<uint32_t> &outputs,
+                           const RowLayout &layout, size_t firstRow,
+                           size_t lastRow, string &out,
+                           vector<char> &detected, mutex &detectedLock) {
+    vector<word> values(netlist.signalIds.size());
+    size_t n = netlist.inputs.size();
+    // columns of the row, every word has all bits equal
+    vector<word> row(layout.columns);
+    vector<char> detectedInChunk(layout.columns - n, false);
+
+    for (size_t r = firstRow; r < lastRow; ++r) {
+        for (size_t j = 0; j < n; ++j)
+            row[j] = ((r >> (n - 1 - j)) & 1) != 0 ? ~word(0) : 0;
+
+        for (auto const &group : groups) {
+            word lanes = simulateFaultGroup(netlist, group, outputs, values, r);
+            for (size_t i = 0; i < group.faultCount; ++i) {
+                bool isDetected = ((lanes >> (i + 1)) & 1) != 0;
+                row[n + group.firstFault + i] = isDetected ? ~word(0) : 0;
+                if (isDetected)
+                    detectedInChunk[group.firstFault + i] = true;
+            }
+        }
+
+        size_t pos = out.size();
+        out.resize(pos + layout.width);
+        formatRow(layout, row, 0, out.data() + pos);
     }
+
+    if (statistics.enabled())
+        statistics.gatesValuated += (lastRow - firstRow) * groups.size()
+                                    * netlist.instructions.size();
+
+    lock_guard<mutex> lock(detectedLock);
+    for (size_t i = 0; i < detectedInChunk.size(); ++i)
+        detected[i] = detected[i] || detectedInChunk[i];
 }
 
 /**
- * Determines currentSignal valuation based on its parents
- * @param currentSignal : id of current signal
- * @param valuation : map with valuations
- * @param g : graph
+ * Prints table of detected stuck-at-0 and stuck-at-1 faults of all signals.
+ * Faults are observed on signals that are not read by any gate, or on the
+ * requested outputs if they are given. Rows hold
+ * values of input signals followed by one column per fault, ordered by
+ * signals and stuck-at-0 first. Number of detected faults is reported on
+ * the standard error.
+ * @param g : child to gate type and set of parents mapping
+ * @param options : options given in command line
+ * @return true if the table was written, otherwise false
  */
-static bool dfsWithValuation(int32_t currentSignal,
-                             unordered_map<int32_t, bool> &valuation,
-                             const graph &g) {
-    // if currentSignal has been valuated before, return it value
-    if (valuation.contains(currentSignal)) {
-        return valuation.at(currentSignal);
+static bool printFaultTable(graph &g, const Options &options) {
+    statistics.startPhase("compile");
+    Netlist netlist = compileNetlist(g);
+    size_t first, last;
+
+    if (!selectRows(options, netlist.inputs.size(), first, last))
+        return false;
+
+    vector<char> isRead(netlist.signalIds.size(), false);
+    for (auto operand : netlist.operands)
+        isRead[operand] = true;
+
+    vector<uint32_t> outputs;
+    for (auto const &inst : netlist.instructions) {
+        if (!isRead[inst.output])
+            outputs.push_back(inst.output);
+    }
+    if (!options.outputs.empty()) {
+        // faults are observed on the requested signals only
+        outputs.clear();
+        for (auto id : options.outputs) {
+            auto it = lower_bound(netlist.signalIds.begin(),
+                                  netlist.signalIds.end(), id);
+            outputs.push_back((uint32_t)(it - netlist.signalIds.begin()));
+        }
     }
-    // valuate all parent signals
-    vector<char> parentSignals;
-    for (auto parentSignal : g.at(currentSignal).second) {
-        parentSignals.push_back(dfsWithValuation(parentSignal, valuation, g));
+
+    vector<FaultGroup> groups = createFaultGroups(netlist);
+    size_t faultCount = 2 * netlist.signalIds.size();
+    vector<uint32_t> columns(netlist.inputs.size() + faultCount);
+    iota(columns.begin(), columns.end(), 0);
+    RowLayout layout = createRowLayout(columns, options.format);
+    vector<char> detected(faultCount, false);
+    mutex detectedLock;
+    OutputWriter writer(STDOUT_FILENO);
+    statistics.startPhase("valuation");
+
+    printRowsInOrder(writer, first, last, options.threads,
+                     [&](size_t first, size_t last, string &out) {
+                         printFaultRows(netlist, groups, outputs, layout,
+                                        first, last, out, detected,
+                                        detectedLock);
+                     });
+
+    statistics.startPhase("output");
+    if (!writer.flush()) {
+        cerr << "Error: cannot write the fault table.\n";
+        return false;
     }
 
-    bool currentSignalValuation = valuateSignalBasedOnParentsAndGate(
-            parentSignals, g.at(currentSignal).first);
-    // put valuation in the map
-    valuation.insert(make_pair(currentSignal, currentSignalValuation));
-    return currentSignalValuation;
+    cerr << "Detected " << count(detected.begin(), detected.end(), true)
+         << " of " << faultCount << " faults.\n";
+    return true;
+}
+
+/**
+ * Reduced ordered binary decision diagrams over input signals, ordered as
+ * in netlist. Nodes are shared between all diagrams through the unique
+ * table, results of operations are kept in a direct-mapped cache.
+ * Diagrams are identified by indices of their root nodes.
+ */
+class BddManager {
+public:
+    static constexpr uint32_t FALSE = 0;
+    static constexpr uint32_t TRUE = 1;
+
+    explicit BddManager(size_t variables)
+            : variables(variables), cache(BDD_CACHE_SIZE) {
+        // terminals are placed below all variables
+        nodes.push_back(Node{(uint32_t)variables, FALSE, FALSE});
+        nodes.push_back(Node{(uint32_t)variables, TRUE, TRUE});
+    }
+
+    /** Diagram of a single variable. */
+    uint32_t variable(size_t v) {
+        return makeNode((uint32_t)v, FALSE, TRUE);
+    }
+
+    /**
+     * Combines two diagrams with AND, OR or XOR.
+     * @throws length_error if there are too many nodes
+     */
+    uint32_t apply(Gate op, uint32_t a, uint32_t b) {
+        if (op == AND) {
+            if (a == FALSE || b == FALSE)
+                return FALSE;
+            if (a == TRUE || a == b)
+                return b;
+            if (b == TRUE)
+                return a;
+        } else if (op == OR) {
+            if (a == TRUE || b == TRUE)
+                return TRUE;
+            if (a == FALSE || a == b)
+                return b;
+            if (b == FALSE)
+                return a;
+        } else {
+            if (a == b)
+                return FALSE;
+            if (a == FALSE)
+                return b;
+            if (b == FALSE)
+                return a;
+        }
+        // all operations are commutative
+        if (a > b)
+            swap(a, b);
+
+        ++lookups;
+        CacheEntry &entry = cache[cacheSlot(op, a, b)];
+        if (entry.op == op && entry.a == a && entry.b == b)
+            return entry.result;
+
+        uint32_t v = min(nodes[a].variable, nodes[b].variable);
+        auto [aLow, aHigh] = cofactors(a, v);
+        auto [bLow, bHigh] = cofactors(b, v);
+        uint32_t low = apply(op, aLow, bLow);
+        uint32_t high = apply(op, aHigh, bHigh);
+        uint32_t result = makeNode(v, low, high);
+
+        // recursive calls may have reused the slot, the newest result stays
+        entry = CacheEntry{op, a, b, result};
+        return result;
+    }
+
+    /**
+     * Negates the diagram.
+     * @throws length_error if there are too many nodes
+     */
+    uint32_t negate(uint32_t a) {
+        if (a <= TRUE)
+            return a ^ 1;
+
+        ++lookups;
+        CacheEntry &entry = cache[cacheSlot(NOT, a, a)];
+        if (entry.op == NOT && entry.a == a)
+            return entry.result;
+
+        Node node = nodes[a];
+        uint32_t result = makeNode(node.variable, negate(node.low),
+                                   negate(node.high));
+        entry = CacheEntry{NOT, a, a, result};
+        return result;
+    }
+
+    /** Number of valuations of all variables satisfying the diagram. */
+    unsigned __int128 satisfyingCount(uint32_t a) {
+        if (counts.size() < nodes.size())
+            counts.resize(nodes.size(), UNKNOWN_COUNT);
+        return count(a) << nodes[a].variable;
+    }
+
+    /**
+     * Finds a valuation satisfying the diagram.
+     * @param a : diagram other than FALSE
+     * @return values of variables
+     */
+    vector<char> satisfyingValuation(uint32_t a) const {
+        vector<char> valuation(variables, false);
+        while (a > TRUE) {
+            Node const &node = nodes[a];
+            valuation[node.variable] = node.low == FALSE;
+            a = node.low == FALSE ? node.high : node.low;
+        }
+        return valuation;
+    }
+
+    /**
+     * Valuates the diagram.
+     * @param a : diagram
+     * @param value : function returning value of the variable
+     */
+    bool valuate(uint32_t a, const function<bool(size_t)> &value) const {
+        while (a > TRUE)
+            a = value(nodes[a].variable) ? nodes[a].high : nodes[a].low;
+        return a == TRUE;
+    }
+
+    /** Number of lookups in the unique table and the cache so far. */
+    uint64_t hashLookups() const {
+        return lookups;
+    }
+
+private:
+    struct Node {
+        uint32_t variable;
+        uint32_t low;
+        uint32_t high;
+    };
+
+    struct CacheEntry {
+        Gate op = NOT;
+        uint32_t a = UINT32_MAX;
+        uint32_t b = UINT32_MAX;
+        uint32_t result = FALSE;
+    };
+
+    static constexpr unsigned __int128 UNKNOWN_COUNT = ~(unsigned __int128)0;
+
+    size_t variables;
+    vector<Node> nodes;
+    /** Node with given variable and children, for every non-terminal node. */
+    unordered_map<uint64_t, vector<uint32_t>> uniqueTable;
+    vector<CacheEntry> cache;
+    /** Satisfying valuations of variables below each node. */
+    vector<unsigned __int128> counts;
+    /** Number of lookups in the unique table and the cache. */
+    uint64_t lookups = 0;
+
+    static size_t cacheSlot(Gate op, uint32_t a, uint32_t b) {
+        uint64_t h = ((uint64_t)a << 32 | b) * 0x9E3779B97F4A7C15 + op;
+        return (size_t)(h >> 40) & (BDD_CACHE_SIZE - 1);
+    }
+
+    pair<uint32_t, uint32_t> cofactors(uint32_t a, uint32_t v) const {
+        if (nodes[a].variable != v)
+            return {a, a};
+        return {nodes[a].low, nodes[a].high};
+    }
+
+    uint32_t makeNode(uint32_t v, uint32_t low, uint32_t high) {
+        if (low == high)
+            return low;
+
+        // nodes with the same children are chained in one bucket
+        ++lookups;
+        vector<uint32_t> &bucket = uniqueTable[(uint64_t)low << 32 | high];
+        for (auto candidate : bucket) {
+            if (nodes[candidate].variable == v)
+                return candidate;
+        }
+
+        if (nodes.size() >= MAX_BDD_NODES)
+            throw length_error("too many BDD nodes");
+        nodes.push_back(Node{v, low, high});
+        bucket.push_back((uint32_t)(nodes.size() - 1));
+        return (uint32_t)(nodes.size() - 1);
+    }
+
+    unsigned __int128 count(uint32_t a) {
+        if (a <= TRUE)
+            return a;
+        if (counts[a] != UNKNOWN_COUNT)
+            return counts[a];
+
+        Node const &node = nodes[a];
+        counts[a] = (count(node.low)
+                     << (nodes[node.low].variable - node.variable - 1))
+                    + (count(node.high)
+                       << (nodes[node.high].variable - node.variable - 1));
+        return counts[a];
+    }
+};
+
+/**
+ * Builds diagrams of all signals of the netlist.
+ * @param netlist : netlist with instructions sorted topologically
+ * @param manager : manager of diagrams over input signals of the netlist
+ * @return diagram of every signal
+ * @throws length_error if there are too many nodes
+ */
+static vector<uint32_t> buildDiagrams(const Netlist &netlist,
+                                      BddManager &manager) {
+    vector<uint32_t> diagrams(netlist.signalIds.size(), BddManager::FALSE);
+
+    for (size_t j = 0; j < netlist.inputs.size(); ++j)
+        diagrams[netlist.inputs[j]] = manager.variable(j);
+
+    for (auto const &inst : netlist.instructions) {
+        const uint32_t *parents = netlist.operands.data() + inst.firstOperand;
+        uint32_t result;
+
+        switch (inst.gate) {
+            case NOT:
+                result = manager.negate(diagrams[parents[0]]);
+                break;
+            case XOR:
+                // gate with 2 identical input streams is always false
+                result = inst.operandCount == 1
+                         ? BddManager::FALSE
+                         : manager.apply(XOR, diagrams[parents[0]],
+                                         diagrams[parents[1]]);
+                break;
+            default: {
+                bool isAnd = inst.gate == AND || inst.gate == NAND;
+                result = isAnd ? BddManager::TRUE : BddManager::FALSE;
+                for (uint32_t i = 0; i < inst.operandCount; ++i)
+                    result = manager.apply(isAnd ? AND : OR, result,
+                                           diagrams[parents[i]]);
+                if (inst.gate == NAND || inst.gate == NOR)
+                    result = manager.negate(result);
+            }
+        }
+        diagrams[inst.output] = result;
+    }
+    return diagrams;
+}
+
+/**
+ * Returns decimal representation of the number.
+ * @param n : number
+ * @return decimal representation
+ */
+static string toDecimal(unsigned __int128 n) {
+    string digits;
+    do {
+        digits.push_back((char)('0' + (int)(n % 10)));
+        n /= 10;
+    } while (n != 0);
+    reverse(digits.begin(), digits.end());
+    return digits;
+}
+
+/**
+ * Finds index of the signal in the netlist.
+ * @param netlist : netlist
+ * @param id : id of the signal
+ * @param index : set to index of the signal
+ * @return true if the signal exists, otherwise false
+ */
+static bool findSignal(const Netlist &netlist, int32_t id, uint32_t &index) {
+    auto it = lower_bound(netlist.signalIds.begin(), netlist.signalIds.end(),
+                          id);
+    if (it == netlist.signalIds.end() || *it != id) {
+        cerr << "Error: signal " << id << " does not exist.\n";
+        return false;
+    }
+    index = (uint32_t)(it - netlist.signalIds.begin());
+    return true;
 }
 
 /**
- * Valuates all signals from the graph and inserts their value to valuation map
- * @param valuation
- * @param g
- * @param signals
+ * Analyzes the circuit symbolically, with binary decision diagrams, so
+ * that its size is not limited by the number of rows. Depending on options
+ * prints either the number of rows in which each signal is 1, or whether
+ * two signals are equivalent, or selected rows of the truth table. Rows
+ * are numbered as in the truth table, input signals beyond the 64 last ones
+ * are 0 in all of them.
+ * @param g : child to gate type and set of parents mapping
+ * @param options : options given in command line
+ * @return true if the analysis succeeded, otherwise false
  */
-static void populateValuation(unordered_map<int32_t, bool> &valuation,
-                              const graph &g,
-                              const unordered_set<int32_t> &signals) {
-    for (auto signal : signals) {
-        dfsWithValuation(signal, valuation, g);
+static bool analyzeSymbolically(graph &g, const Options &options) {
+    statistics.startPhase("compile");
+    Netlist netlist = compileNetlist(g);
+    size_t n = netlist.inputs.size();
+
+    if (!options.equivalentGiven)
+        netlist.columns = selectColumns(netlist, options);
+    vector<uint32_t> printed = netlist.columns;
+
+    if (options.optimize)
+        optimizeNetlist(netlist, statistics.libraryCounters());
+
+    statistics.startPhase("valuation");
+    BddManager manager(n);
+    vector<uint32_t> diagrams;
+
+    try {
+        diagrams = buildDiagrams(netlist, manager);
+        if (statistics.enabled())
+            statistics.gatesValuated += netlist.instructions.size();
+    } catch (const length_error &) {
+        cerr << "Error: binary decision diagrams of the circuit are too "
+                "large.\n";
+        return false;
+    }
+
+    string out;
+
+    if (options.equivalentGiven) {
+        uint32_t a, b;
+        if (!findSignal(netlist, options.equivalent.first, a)
+            || !findSignal(netlist, options.equivalent.second, b))
+            return false;
+
+        uint32_t difference = manager.apply(XOR, diagrams[netlist.columns[a]],
+                                            diagrams[netlist.columns[b]]);
+        out = "Signals " + to_string(options.equivalent.first) + " and "
+              + to_string(options.equivalent.second);
+        if (difference == BddManager::FALSE) {
+            out += " are equivalent.\n";
+        } else {
+            // values of input signals in a row in which signals differ
+            out += " differ for inputs ";
+            for (auto value : manager.satisfyingValuation(difference))
+                out += value ? '1' : '0';
+            out += ".\n";
+        }
+    } else if (options.rowsGiven) {
+        RowLayout layout = createRowLayout(netlist.columns, options.format);
+        vector<word> values(netlist.signalIds.size());
+
+        if (options.firstRow > options.lastRow) {
+            cerr << "Error: rows " << options.firstRow << ":"
+                 << options.lastRow << " are reversed.\n";
+            return false;
+        }
+        if (n <= MAX_INPUT_SIGNALS && options.lastRow > ((size_t)1 << n)) {
+            cerr << "Error: rows " << options.firstRow << ":"
+                 << options.lastRow << " are out of range 0:"
+                 << ((size_t)1 << n) << ".\n";
+            return false;
+        }
+
+        for (size_t row = options.firstRow; row < options.lastRow; ++row) {
+            auto value = [&](size_t j) {
+                return n - 1 - j < WORD_BITS && ((row >> (n - 1 - j)) & 1) != 0;
+            };
+            for (auto column : netlist.columns)
+                values[column] = manager.valuate(diagrams[column], value)
+                                 ? ~word(0) : 0;
+
+            size_t pos = out.size();
+            out.resize(pos + layout.width);
+            formatRow(layout, values, 0, out.data() + pos);
+        }
+        if (statistics.enabled())
+            statistics.rows += options.lastRow - options.firstRow;
+    } else {
+        if (n > 127) {
+            cerr << "Error: numbers of rows of a circuit with " << n
+                 << " input signals cannot be counted.\n";
+            return false;
+        }
+        for (size_t i = 0; i < netlist.columns.size(); ++i) {
+            out += to_string(netlist.signalIds[printed[i]]) + " "
+                   + toDecimal(manager.satisfyingCount(
+                           diagrams[netlist.columns[i]])) + "\n";
+        }
+    }
+
+    if (statistics.enabled())
+        statistics.counters.hashLookups += manager.hashLookups();
+    statistics.startPhase("output");
+    OutputWriter writer(STDOUT_FILENO);
+    writer.write(out);
+
+    if (!writer.flush()) {
+        cerr << "Error: cannot write the result of the analysis.\n";
+        return false;
     }
+    return true;
 }
 
 /**
- * Prints given valuation.
- * @param valuation : valuation
+ * Valuates vectors of input values read from a file descriptor and prints
+ * rows of the truth table for them, in the same order. Every line holds
+ * values of input signals in ascending order of ids, as '0' and '1'
+ * characters. Vectors are valuated in batches of WORD_BITS.
+ * @param g : acyclic graph
+ * @param options : options given in command line
+ * @param fd : file descriptor of vectors
+ * @return true if all vectors were correct and rows were written, otherwise
+ * false
  */
-static void printValuation(unordered_map<int32_t, bool> &valuation) {
-    vector<int32_t> keys;
-    keys.reserve(valuation.size());
+static bool printVectorRows(const graph &g, const Options &options, int fd) {
+    statistics.startPhase("compile");
+    Circuit circuit(g, options.optimize);
+    unique_ptr<NativeKernel> native;
 
-    for (auto i : valuation)
-        keys.push_back(i.first);
+    if (options.compile) {
+        native = make_unique<NativeKernel>(circuit.netlist());
+        circuit.useKernel(native->kernel());
+    }
 
-    sort(keys.begin(), keys.end());
+    size_t n = circuit.inputCount();
+    vector<uint32_t> columns = selectColumns(circuit.netlist(), options);
+    RowLayout layout = createRowLayout(columns, options.format);
+    vector<word> inputs(n);
+    vector<word> values(circuit.signalCount());
+    vector<word> scratch;
+    LineReader reader(fd);
+    OutputWriter writer(STDOUT_FILENO);
+    string out;
+    size_t lineCount = 0;
+    size_t batch = 0;
+    bool correct = true;
+    uint64_t batches = 0;
+    statistics.startPhase("valuation");
 
-    for (size_t i = 0; i < valuation.size(); ++i)
-        cout << valuation.at(keys[i]);
+    auto printBatch = [&]() {
+        circuit.valuate(inputs.data(), values.data(), scratch);
+        ++batches;
+        size_t pos = out.size();
+        out.resize(pos + batch * layout.width);
+        for (size_t r = 0; r < batch; ++r, pos += layout.width)
+            formatRow(layout, values, r, out.data() + pos);
+        if (out.size() >= CHUNK_ROWS * layout.width) {
+            writer.write(out);
+            out.clear();
+        }
+        fill(inputs.begin(), inputs.end(), 0);
+        batch = 0;
+    };
+
+    for (string_view line; reader.next(line);) {
+        ++lineCount;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
 
-    cout << "\n";
+        if (line.size() != n
+            || line.find_first_not_of("01") != string_view::npos) {
+            cerr << "Error in vector line " << lineCount << ": " << line
+                 << "\n";
+            correct = false;
+            break;
+        }
+
+        for (size_t j = 0; j < n; ++j) {
+            if (line[j] == '1')
+                inputs[j] |= word(1) << batch;
+        }
+        if (++batch == WORD_BITS)
+            printBatch();
+    }
+    if (batch != 0)
+        printBatch();
+    writer.write(out);
+    if (statistics.enabled()) {
+        statistics.gatesValuated += batches
+                                    * circuit.netlist().instructions.size();
+        statistics.rows += lineCount - (correct ? 0 : 1);
+    }
+
+    statistics.startPhase("output");
+    if (!writer.flush()) {
+        cerr << "Error: cannot write the valuations.\n";
+        return false;
+    }
+    return correct;
 }
 
 /**
- * Produces valuations in correct order, populate and print them.
+ * Opens a file for reading.
+ * @param path : path of the file, "-" stands for the standard input
+ * @return file descriptor, or -1 if the file cannot be opened
+ */
+static int openInput(const string &path) {
+    if (path == "-")
+        return STDIN_FILENO;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        cerr << "Error: cannot open " << path << ".\n";
+    return fd;
+}
+
+/**
+ * Prints feedback loops of the circuit, i.e. its strongly connected
+ * components containing a cycle, one per line as ids of their signals.
  * @param g : child to gate type and set of parents mapping
+ * @return true if the loops were written, otherwise false
  */
-static void printTruthTable(graph &g) {
-    unordered_set<int32_t> inputSignals = findInputSignals(g);
-    vector<int32_t> keys;
-    size_t n = inputSignals.size();
-    keys.reserve(n);
-    vector<char> bitset;
-    bitset.reserve(n);
+static bool printCycles(const graph &g) {
+    string out;
 
-    for (size_t i = 0; i < n; ++i)
-        bitset[i] = false;
+    for (auto const &component : findCycles(g)) {
+        for (size_t i = 0; i < component.size(); ++i) {
+            if (i != 0)
+                out += ' ';
+            out += to_string(component[i]);
+        }
+        out += '\n';
+    }
 
-    for (auto i = inputSignals.begin(); i != inputSignals.end();)
-        keys.push_back(inputSignals.extract(i++).value());
+    OutputWriter writer(STDOUT_FILENO);
+    writer.write(out);
 
-    // sort valuation by input signals
-    sort(keys.begin(), keys.end());
+    if (!writer.flush()) {
+        cerr << "Error: cannot write feedback loops.\n";
+        return false;
+    }
+    return true;
+}
 
-    for (size_t i = 0; i < (size_t)pow(2, n); ++i) {
-        unordered_map<int32_t, bool> valuation;
-        toBinary(i, n, bitset);
+/**
+ * Parses command line arguments.
+ * @param argc : number of arguments
+ * @param argv : arguments
+ * @param options : options to fill
+ * @return true if arguments are correct, otherwise false
+ */
+static bool parseArguments(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
 
-        // giving following binary numbers to sorted input signals
-        for (size_t j = 0; j < n; ++j)
-            valuation.insert(make_pair(keys[j], bitset[j]));
+        if (arg == "--threads" && i + 1 < argc) {
+            string value = argv[++i];
+            if (!parseNumber(value, options.threads) || options.threads == 0
+                || options.threads > MAX_THREADS) {
+                cerr << "Error: invalid number of threads: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--rows" && i + 1 < argc) {
+            string_view value = argv[++i];
+            size_t colon = value.find(':');
+            if (colon == string_view::npos
+                || !parseNumber(value.substr(0, colon), options.firstRow)
+                || !parseNumber(value.substr(colon + 1), options.lastRow)) {
+                cerr << "Error: invalid range of rows: " << value << "\n";
+                return false;
+            }
+            options.rowsGiven = true;
+        } else if (arg == "--shard" && i + 1 < argc) {
+            string_view value = argv[++i];
+            size_t slash = value.find('/');
+            if (slash == string_view::npos
+                || !parseNumber(value.substr(0, slash), options.shard)
+                || !parseNumber(value.substr(slash + 1), options.shardCount)
+                || options.shard >= options.shardCount) {
+                cerr << "Error: invalid shard: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--engine" && i + 1 < argc) {
+            string value = argv[++i];
+            if (value == "bitslice") {
+                options.engine = BITSLICE;
+            } else if (value == "gray") {
+                options.engine = GRAY;
+            } else {
+                cerr << "Error: invalid engine: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--binary") {
+            options.format = BINARY;
+        } else if (arg == "--bdd") {
+            options.symbolic = true;
+        } else if (arg == "--equivalent" && i + 1 < argc) {
+            string_view value = argv[++i];
+            size_t comma = value.find(',');
+            if (comma == string_view::npos
+                || !correctSignal(value.substr(0, comma),
+                                  options.equivalent.first)
+                || !correctSignal(value.substr(comma + 1),
+                                  options.equivalent.second)) {
+                cerr << "Error: invalid pair of signals: " << value << "\n";
+                return false;
+            }
+            options.symbolic = options.equivalentGiven = true;
+        } else if (arg == "--compile") {
+            options.compile = true;
+        } else if (arg == "--circuit" && i + 1 < argc) {
+            options.circuitPath = argv[++i];
+        } else if (arg == "--vectors" && i + 1 < argc) {
+            options.vectorsPath = argv[++i];
+        } else if (arg == "--outputs" && i + 1 < argc) {
+            string_view value = argv[++i];
+            options.outputs.clear();
+            for (size_t pos = 0; pos <= value.size();) {
+                size_t comma = min(value.find(',', pos), value.size());
+                int32_t id;
+                if (!correctSignal(value.substr(pos, comma - pos), id)) {
+                    cerr << "Error: invalid list of signals: " << value
+                         << "\n";
+                    return false;
+                }
+                options.outputs.push_back(id);
+                pos = comma + 1;
+            }
+            sort(options.outputs.begin(), options.outputs.end());
+            options.outputs.erase(unique(options.outputs.begin(),
+                                         options.outputs.end()),
+                                  options.outputs.end());
+        } else if (arg == "--stats" && i + 1 < argc) {
+            string value = argv[++i];
+            if (value != "text" && value != "json") {
+                cerr << "Error: invalid format of statistics: " << value
+                     << "\n";
+                return false;
+            }
+            options.stats = true;
+            options.statsJson = value == "json";
+        } else if (arg == "--cycles") {
+            options.cycles = true;
+        } else if (arg == "--faults") {
+            options.faults = true;
+        } else if (arg == "--no-optimize") {
+            options.optimize = false;
+        } else {
+            cerr << "Error: invalid argument: " << arg << "\n";
+            return false;
+        }
+    }
 
-        unordered_set<int32_t> signals = getNonInputSignals(g);
-        populateValuation(valuation, g, signals);
-        printValuation(valuation);
+    if (options.symbolic && (options.shardCount != 0 || options.faults)) {
+        cerr << "Error: --bdd cannot be used with --shard or --faults.\n";
+        return false;
+    }
+
+    if (options.rowsGiven && options.shardCount != 0) {
+        cerr << "Error: --rows and --shard cannot be used together.\n";
+        return false;
+    }
+
+    if (options.vectorsPath == options.circuitPath) {
+        cerr << "Error: the circuit and vectors cannot be read from the same "
+                "input.\n";
+        return false;
     }
+    return true;
 }
 
-int main() {
-    pair<bool, graph> p = parseInput();
+/**
+ * Reads the circuit and prints what the options ask for.
+ * @param options : options given in command line
+ * @return exit code of the program
+ */
+static int run(const Options &options) {
+    statistics.startPhase("parse");
+    int circuitFd = openInput(options.circuitPath);
+    if (circuitFd < 0)
+        return 1;
+
+    pair<bool, graph> p = parseInput(circuitFd);
 
     if (!p.first) {
         // there was some error when parsing input
@@ -442,13 +2126,70 @@ int main() {
     }
 
     graph g = p.second;
+    statistics.startPhase("cycle check");
 
-    if (hasCycle(g)) {
-        cerr << "Error: ";
-        cerr << "sequential logic analysis has not yet been implemented.\n";
-        return 1;
+    if (!options.outputs.empty()) {
+        for (auto id : options.outputs) {
+            if (g.count(id) == 0) {
+                cerr << "Error: signal " << id
+                     << " is not an output of any gate.\n";
+                return 1;
+            }
+        }
+        g = extractCone(g, options.outputs, statistics.libraryCounters());
+    }
+
+    if (options.cycles)
+        return printCycles(g) ? 0 : 1;
+
+    bool sequential = hasCycle(g, statistics.libraryCounters());
+
+    if (!options.vectorsPath.empty()) {
+        if (sequential) {
+            cerr << "Error: ";
+            cerr << "valuation of vectors of sequential circuits is not "
+                    "supported.\n";
+            return 1;
+        }
+        int vectorsFd = openInput(options.vectorsPath);
+        if (vectorsFd < 0)
+            return 1;
+        return printVectorRows(g, options, vectorsFd) ? 0 : 1;
     }
 
-    printTruthTable(g);
-    return 0;
+    if (options.symbolic) {
+        if (sequential) {
+            cerr << "Error: ";
+            cerr << "symbolic analysis of sequential circuits is not supported.\n";
+            return 1;
+        }
+        return analyzeSymbolically(g, options) ? 0 : 1;
+    }
+
+    if (options.faults) {
+        if (sequential) {
+            cerr << "Error: ";
+            cerr << "fault simulation of sequential circuits is not supported.\n";
+            return 1;
+        }
+        return printFaultTable(g, options) ? 0 : 1;
+    }
+
+    return printTruthTable(g, options, sequential) ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+
+    if (!parseArguments(argc, argv, options))
+        return 1;
+
+    if (options.stats)
+        statistics.enable();
+
+    int status = run(options);
+
+    if (options.stats)
+        statistics.report(options.statsJson);
+    return status;
 }